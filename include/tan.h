@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// C API for embedding tan in another program, provided by libtan.
+//
+// A context holds the global variables of one interpreter and keeps them between evaluations. A
+// program is a parsed source; it does not belong to any context and can be evaluated as often as
+// needed, by several contexts and from several threads at once. A context must only be used by
+// one thread at a time.
+//
+// This is the only header libtan exposes to embedders, and the functions below are the only ones
+// the shared library exports.
+#if defined(__GNUC__)
+#define TAN_API __attribute__((visibility("default")))
+#else
+#define TAN_API
+#endif
+
+typedef struct TAN_CONTEXT TAN_CONTEXT;
+typedef struct TAN_PROGRAM TAN_PROGRAM;
+
+// With `workers` greater than 0 the context gets a thread pool of that size for map and reduce.
+TAN_API TAN_CONTEXT *TanNewContext(size_t workers);
+TAN_API void TanFreeContext(TAN_CONTEXT *context);
+// Limits every evaluation to `fuel_limit` calls and `memory_limit` bytes; SIZE_MAX is unlimited,
+// which is the default.
+TAN_API void TanSetLimits(TAN_CONTEXT *context, size_t fuel_limit, size_t memory_limit);
+
+// Returns NULL if `source` has syntax errors, which are reported on stderr.
+TAN_API TAN_PROGRAM *TanCompile(char const *source);
+TAN_API void TanFreeProgram(TAN_PROGRAM *program);
+
+// Evaluates `program` in `context` and stores its result, which has to be a number, in `result`.
+// Returns false if the evaluation failed, in which case TanError describes why.
+TAN_API bool TanEvaluate(TAN_CONTEXT *context, TAN_PROGRAM const *program, double *result);
+TAN_API char const *TanError(TAN_CONTEXT const *context);
+
+// Global variables, for passing numbers in and out of programs. TanGetNumber returns false if
+// there is no global `name` holding a number.
+TAN_API void TanSetNumber(TAN_CONTEXT *context, char const *name, double value);
+TAN_API bool TanGetNumber(TAN_CONTEXT *context, char const *name, double *value);
+
+// A C function over numbers that tan programs can call. It receives its arguments and the `data`
+// it was registered with.
+typedef double TAN_FUNCTION(double const *args, void *data);
+// Defines `function`, taking `param_count` numbers, as the global `name` of every context created
+// afterwards; calling it with anything but numbers is an error. Registering is not thread-safe and
+// has to happen before contexts are created on other threads; `data` has to stay valid for as
+// long as they are used. Returns false if `function` takes more than 4 parameters.
+TAN_API bool TanRegisterFunction(char const *name, size_t param_count, TAN_FUNCTION *function,
+                                 void *data);
@@ -0,0 +1,185 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "array.h"
+#include "stats.h"
+#include "unreachable.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define ARRAY_SIMD 1
+#endif
+
+ARRAY *NewArray(size_t count)
+{
+  COUNT_ALLOCATION(STATS_MEMORY_ARRAYS, ArraySize(count));
+  ARRAY *array = malloc(ArraySize(count));
+  atomic_init(&array->refs, 1);
+  array->count = count;
+  return array;
+}
+
+size_t ArraySize(size_t count)
+{
+  return sizeof(ARRAY) + sizeof(double) * count;
+}
+
+void RetainArray(ARRAY *array)
+{
+  atomic_fetch_add_explicit(&array->refs, 1, memory_order_relaxed);
+}
+
+void ReleaseArray(ARRAY *array)
+{
+  if (atomic_fetch_sub_explicit(&array->refs, 1, memory_order_acq_rel) == 1)
+    free(array);
+}
+
+// ---------------
+// Kernels
+// ---------------
+
+typedef enum
+{
+  SHAPE_ARRAY_ARRAY,
+  SHAPE_ARRAY_SCALAR,
+  SHAPE_SCALAR_ARRAY,
+} ARRAY_SHAPE;
+
+// Scalar operands are passed as a pointer to a single number.
+typedef void KERNEL(double *out, double const *a, double const *b, size_t n, ARRAY_SHAPE shape);
+
+#define DEFINE_SCALAR_KERNEL(name, OP)                                                             \
+  static void name(double *out, double const *a, double const *b, size_t n, ARRAY_SHAPE shape)     \
+  {                                                                                                \
+    switch (shape)                                                                                 \
+    {                                                                                              \
+      case SHAPE_ARRAY_ARRAY:                                                                      \
+        for (size_t i = 0; i < n; i++)                                                             \
+          out[i] = a[i] OP b[i];                                                                   \
+        break;                                                                                     \
+      case SHAPE_ARRAY_SCALAR:                                                                     \
+        for (size_t i = 0; i < n; i++)                                                             \
+          out[i] = a[i] OP * b;                                                                    \
+        break;                                                                                     \
+      case SHAPE_SCALAR_ARRAY:                                                                     \
+        for (size_t i = 0; i < n; i++)                                                             \
+          out[i] = *a OP b[i];                                                                     \
+        break;                                                                                     \
+    }                                                                                              \
+  }
+
+#ifdef ARRAY_SIMD
+// Processes WIDTH lanes at a time with LOAD/STORE/SPLAT/VOP and finishes the tail one element at a
+// time.
+#define DEFINE_VECTOR_KERNEL(name, ISA, VECTOR, WIDTH, LOAD, STORE, SPLAT, VOP, OP)                \
+  __attribute__((target(ISA))) static void name(double *out, double const *a, double const *b,     \
+                                                size_t n, ARRAY_SHAPE shape)                       \
+  {                                                                                                \
+    size_t i = 0;                                                                                  \
+    switch (shape)                                                                                 \
+    {                                                                                              \
+      case SHAPE_ARRAY_ARRAY:                                                                      \
+        for (; i + WIDTH <= n; i += WIDTH)                                                         \
+          STORE(out + i, VOP(LOAD(a + i), LOAD(b + i)));                                           \
+        for (; i < n; i++)                                                                         \
+          out[i] = a[i] OP b[i];                                                                   \
+        break;                                                                                     \
+      case SHAPE_ARRAY_SCALAR: {                                                                   \
+        VECTOR scalar = SPLAT(*b);                                                                 \
+        for (; i + WIDTH <= n; i += WIDTH)                                                         \
+          STORE(out + i, VOP(LOAD(a + i), scalar));                                                \
+        for (; i < n; i++)                                                                         \
+          out[i] = a[i] OP * b;                                                                    \
+        break;                                                                                     \
+      }                                                                                            \
+      case SHAPE_SCALAR_ARRAY: {                                                                   \
+        VECTOR scalar = SPLAT(*a);                                                                 \
+        for (; i + WIDTH <= n; i += WIDTH)                                                         \
+          STORE(out + i, VOP(scalar, LOAD(b + i)));                                                \
+        for (; i < n; i++)                                                                         \
+          out[i] = *a OP b[i];                                                                     \
+        break;                                                                                     \
+      }                                                                                            \
+    }                                                                                              \
+  }
+
+#define DEFINE_AVX2_KERNEL(name, VOP, OP)                                                          \
+  DEFINE_VECTOR_KERNEL(name, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,                \
+                       _mm256_set1_pd, VOP, OP)
+#define DEFINE_SSE2_KERNEL(name, VOP, OP)                                                          \
+  DEFINE_VECTOR_KERNEL(name, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, VOP, OP)
+
+DEFINE_AVX2_KERNEL(AddAVX2, _mm256_add_pd, +)
+DEFINE_AVX2_KERNEL(SubAVX2, _mm256_sub_pd, -)
+DEFINE_AVX2_KERNEL(MulAVX2, _mm256_mul_pd, *)
+DEFINE_AVX2_KERNEL(DivAVX2, _mm256_div_pd, /)
+DEFINE_SSE2_KERNEL(AddSSE2, _mm_add_pd, +)
+DEFINE_SSE2_KERNEL(SubSSE2, _mm_sub_pd, -)
+DEFINE_SSE2_KERNEL(MulSSE2, _mm_mul_pd, *)
+DEFINE_SSE2_KERNEL(DivSSE2, _mm_div_pd, /)
+#else
+DEFINE_SCALAR_KERNEL(AddScalar, +)
+DEFINE_SCALAR_KERNEL(SubScalar, -)
+DEFINE_SCALAR_KERNEL(MulScalar, *)
+DEFINE_SCALAR_KERNEL(DivScalar, /)
+#endif
+
+static KERNEL *SelectKernel(BINARY_OPERATION_KIND op)
+{
+#ifdef ARRAY_SIMD
+  if (__builtin_cpu_supports("avx2"))
+  {
+    switch (op)
+    {
+      case BINOP_ADD:
+        return AddAVX2;
+      case BINOP_SUB:
+        return SubAVX2;
+      case BINOP_MUL:
+        return MulAVX2;
+      case BINOP_DIV:
+        return DivAVX2;
+    }
+  }
+
+  switch (op)
+  {
+    case BINOP_ADD:
+      return AddSSE2;
+    case BINOP_SUB:
+      return SubSSE2;
+    case BINOP_MUL:
+      return MulSSE2;
+    case BINOP_DIV:
+      return DivSSE2;
+  }
+#else
+  switch (op)
+  {
+    case BINOP_ADD:
+      return AddScalar;
+    case BINOP_SUB:
+      return SubScalar;
+    case BINOP_MUL:
+      return MulScalar;
+    case BINOP_DIV:
+      return DivScalar;
+  }
+#endif
+
+  unreachable();
+}
+
+ARRAY *ArrayArithmetic(BINARY_OPERATION_KIND op, ARRAY const *left, double left_scalar,
+                       ARRAY const *right, double right_scalar)
+{
+  ARRAY_SHAPE shape = left == NULL    ? SHAPE_SCALAR_ARRAY
+                      : right == NULL ? SHAPE_ARRAY_SCALAR
+                                      : SHAPE_ARRAY_ARRAY;
+  ARRAY *result = NewArray(left != NULL ? left->count : right->count);
+
+  SelectKernel(op)(result->items, left != NULL ? left->items : &left_scalar,
+                   right != NULL ? right->items : &right_scalar, result->count, shape);
+  return result;
+}
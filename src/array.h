@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "ast.h"
+
+// Immutable, reference-counted arrays of numbers. Values share arrays instead of copying them, so
+// the count is atomic for arrays handed between threads.
+typedef struct
+{
+  atomic_size_t refs;
+  size_t count;
+  double items[];
+} ARRAY;
+
+// The new array holds one reference and uninitialised items.
+ARRAY *NewArray(size_t count);
+size_t ArraySize(size_t count);
+void RetainArray(ARRAY *array);
+void ReleaseArray(ARRAY *array);
+
+// Element-wise arithmetic. Either operand may be NULL to broadcast the corresponding scalar over
+// the other one; arrays must have the same length. The kernels use AVX2 or SSE2 when the CPU
+// supports them.
+ARRAY *ArrayArithmetic(BINARY_OPERATION_KIND op, ARRAY const *left, double left_scalar,
+                       ARRAY const *right, double right_scalar);
@@ -1,12 +1,375 @@
+#include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "ast.h"
+#include "stats.h"
+#include "unreachable.h"
+
+char const *ASTNodeKindName(AST_NODE_KIND kind)
+{
+  switch (kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      return "constant number";
+    case NODE_BINARY_OPERATION:
+      return "binary operation";
+    case NODE_ASSIGNMENT:
+      return "assignment";
+    case NODE_VARIABLE:
+      return "variable";
+    case NODE_LAMBDA:
+      return "lambda";
+    case NODE_CALL:
+      return "call";
+    case NODE_IF_ELSE:
+      return "if-else";
+    case NODE_SEQUENCE:
+      return "sequence";
+    case NODE_LAZY:
+      return "lazy body";
+    case NODE_ARRAY:
+      return "array";
+    case NODE_INDEX:
+      return "index";
+    case NODE_PARAMETER:
+      return "parameter";
+    case NODE_FRAME:
+      return "frame";
+    case NODE_STORE_TEMPORARY:
+      return "store temporary";
+    case NODE_LOAD_TEMPORARY:
+      return "load temporary";
+    case NODE_INVARIANT:
+      return "invariant";
+  }
+
+  assert(!"ASTNodeKindName: unreachable");
+  return NULL;
+}
+
+void *AllocAST(size_t size)
+{
+  COUNT_ALLOCATION(STATS_MEMORY_AST, size);
+  return malloc(size);
+}
+
+char *CopyName(char const *name, size_t len)
+{
+  COUNT_ALLOCATION(STATS_MEMORY_NAMES, len + 1);
+  return strndup(name, len);
+}
+
+char *CopySource(char const *source, size_t len)
+{
+  char *copy = AllocAST(len + 1);
+  memcpy(copy, source, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+AST_NODE *NewASTNode(AST_NODE_KIND kind)
+{
+  AST_NODE *node = AllocAST(sizeof(*node));
+  node->kind = kind;
+  node->interned = false;
+  atomic_init(&node->refs, 1);
+  return node;
+}
+
+// ---------------
+// Structural sharing
+// ---------------
+
+typedef struct INTERN_ENTRY
+{
+  AST_NODE *node;
+  size_t hash;
+  struct INTERN_ENTRY *next;
+} INTERN_ENTRY;
+
+// Shared by all threads. Interned nodes are retained and released without the lock, except for
+// the release that may drop the last reference: it takes the lock, so that InternAST cannot find a
+// node while it is being unlinked.
+static struct
+{
+  pthread_mutex_t lock;
+  INTERN_ENTRY **buckets;
+  size_t bucket_count;
+  size_t count;
+} intern_table = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static bool sharing_enabled;
+
+void SetASTSharing(bool enabled)
+{
+  sharing_enabled = enabled;
+}
+
+static size_t HashBytes(size_t hash, void const *data, size_t len)
+{
+  unsigned char const *bytes = data;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+#define HASH_VALUE(hash, value) HashBytes((hash), &(value), sizeof(value))
+
+// Children are already canonical, so they are hashed and compared by address.
+static size_t HashNode(AST_NODE *node)
+{
+  size_t hash = HASH_VALUE(0xcbf29ce484222325ULL, node->kind);
+
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      return HASH_VALUE(hash, node->constant_number);
+    case NODE_BINARY_OPERATION:
+      hash = HASH_VALUE(hash, node->binary_operation.op);
+      hash = HASH_VALUE(hash, node->binary_operation.left);
+      return HASH_VALUE(hash, node->binary_operation.right);
+    case NODE_ASSIGNMENT:
+      hash = HashBytes(hash, node->assignment.var_name, strlen(node->assignment.var_name));
+      return HASH_VALUE(hash, node->assignment.value);
+    case NODE_VARIABLE:
+      return HashBytes(hash, node->variable, strlen(node->variable));
+    case NODE_LAMBDA:
+      for (size_t i = 0; i < node->lambda.param_count; i++)
+        hash = HashBytes(hash, node->lambda.params[i].name,
+                         strlen(node->lambda.params[i].name) + 1);
+      return HASH_VALUE(hash, node->lambda.body);
+    case NODE_CALL:
+      hash = HASH_VALUE(hash, node->call.fn);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        hash = HASH_VALUE(hash, node->call.args[i].value);
+      return hash;
+    case NODE_IF_ELSE:
+      hash = HASH_VALUE(hash, node->if_else.condition);
+      hash = HASH_VALUE(hash, node->if_else.if_true);
+      return HASH_VALUE(hash, node->if_else.if_false);
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        hash = HASH_VALUE(hash, node->sequence.items[i]);
+      return hash;
+    case NODE_LAZY:
+      return HashBytes(hash, node->lazy.source, strlen(node->lazy.source));
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        hash = HASH_VALUE(hash, node->array.items[i]);
+      return hash;
+    case NODE_INDEX:
+      hash = HASH_VALUE(hash, node->index.array);
+      return HASH_VALUE(hash, node->index.index);
+    case NODE_PARAMETER:
+      return HASH_VALUE(hash, node->parameter);
+    case NODE_FRAME:
+      hash = HASH_VALUE(hash, node->frame.body);
+      return HASH_VALUE(hash, node->frame.slot_count);
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      hash = HASH_VALUE(hash, node->temporary.value);
+      hash = HASH_VALUE(hash, node->temporary.call);
+      return HASH_VALUE(hash, node->temporary.slot);
+  }
+
+  unreachable();
+}
+
+static bool EqualNodes(AST_NODE *a, AST_NODE *b)
+{
+  if (a->kind != b->kind)
+    return false;
+
+  switch (a->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      return memcmp(&a->constant_number, &b->constant_number, sizeof(double)) == 0;
+    case NODE_BINARY_OPERATION:
+      return a->binary_operation.op == b->binary_operation.op &&
+             a->binary_operation.left == b->binary_operation.left &&
+             a->binary_operation.right == b->binary_operation.right;
+    case NODE_ASSIGNMENT:
+      return a->assignment.value == b->assignment.value &&
+             strcmp(a->assignment.var_name, b->assignment.var_name) == 0;
+    case NODE_VARIABLE:
+      return strcmp(a->variable, b->variable) == 0;
+    case NODE_LAMBDA:
+      if (a->lambda.body != b->lambda.body || a->lambda.param_count != b->lambda.param_count)
+        return false;
+      for (size_t i = 0; i < a->lambda.param_count; i++)
+        if (strcmp(a->lambda.params[i].name, b->lambda.params[i].name) != 0)
+          return false;
+      return true;
+    case NODE_CALL:
+      if (a->call.fn != b->call.fn || a->call.arg_count != b->call.arg_count)
+        return false;
+      for (size_t i = 0; i < a->call.arg_count; i++)
+        if (a->call.args[i].value != b->call.args[i].value)
+          return false;
+      return true;
+    case NODE_IF_ELSE:
+      return a->if_else.condition == b->if_else.condition &&
+             a->if_else.if_true == b->if_else.if_true &&
+             a->if_else.if_false == b->if_else.if_false;
+    case NODE_SEQUENCE:
+      if (a->sequence.count != b->sequence.count)
+        return false;
+      for (size_t i = 0; i < a->sequence.count; i++)
+        if (a->sequence.items[i] != b->sequence.items[i])
+          return false;
+      return true;
+    case NODE_LAZY:
+      return strcmp(a->lazy.source, b->lazy.source) == 0;
+    case NODE_ARRAY:
+      if (a->array.count != b->array.count)
+        return false;
+      for (size_t i = 0; i < a->array.count; i++)
+        if (a->array.items[i] != b->array.items[i])
+          return false;
+      return true;
+    case NODE_INDEX:
+      return a->index.array == b->index.array && a->index.index == b->index.index;
+    case NODE_PARAMETER:
+      return a->parameter == b->parameter;
+    case NODE_FRAME:
+      return a->frame.body == b->frame.body && a->frame.slot_count == b->frame.slot_count;
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      return a->temporary.value == b->temporary.value && a->temporary.slot == b->temporary.slot &&
+             a->temporary.call == b->temporary.call;
+  }
+
+  unreachable();
+}
+
+static void GrowInternTable(void)
+{
+  size_t bucket_count = intern_table.bucket_count ? intern_table.bucket_count * 2 : 1024;
+  INTERN_ENTRY **buckets = calloc(bucket_count, sizeof(*buckets));
+
+  for (size_t i = 0; i < intern_table.bucket_count; i++)
+  {
+    INTERN_ENTRY *entry = intern_table.buckets[i];
+    while (entry != NULL)
+    {
+      INTERN_ENTRY *next = entry->next;
+      INTERN_ENTRY **bucket = &buckets[entry->hash & (bucket_count - 1)];
+      entry->next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+
+  free(intern_table.buckets);
+  intern_table.buckets = buckets;
+  intern_table.bucket_count = bucket_count;
+}
+
+AST_NODE *InternAST(AST_NODE *node)
+{
+  if (!sharing_enabled || node->interned)
+    return node;
+
+  size_t hash = HashNode(node);
+  pthread_mutex_lock(&intern_table.lock);
+
+  if (intern_table.bucket_count > 0)
+  {
+    INTERN_ENTRY *entry = intern_table.buckets[hash & (intern_table.bucket_count - 1)];
+    for (; entry != NULL; entry = entry->next)
+      if (entry->hash == hash && EqualNodes(entry->node, node))
+      {
+        AST_NODE *canonical = entry->node;
+        atomic_fetch_add_explicit(&canonical->refs, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&intern_table.lock);
+
+        // The duplicate only releases its references to the canonical children.
+        stats.ast_nodes_shared++;
+        FreeAST(node);
+        return canonical;
+      }
+  }
+
+  if (intern_table.count >= intern_table.bucket_count)
+    GrowInternTable();
+
+  INTERN_ENTRY *entry = AllocAST(sizeof(*entry));
+  INTERN_ENTRY **bucket = &intern_table.buckets[hash & (intern_table.bucket_count - 1)];
+  *entry = (INTERN_ENTRY){.node = node, .hash = hash, .next = *bucket};
+  *bucket = entry;
+  intern_table.count++;
+  node->interned = true;
+  atomic_store_explicit(&node->refs, 1, memory_order_relaxed);
+
+  pthread_mutex_unlock(&intern_table.lock);
+  return node;
+}
+
+static void RetainInterned(AST_NODE *node)
+{
+  atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+}
+
+// Returns true if that was the last reference, in which case the node is no longer interned and
+// its contents can be freed.
+static bool ReleaseInterned(AST_NODE *node)
+{
+  // Other references keep the node alive, so it can be released without the lock. Only InternAST
+  // adds references the releasing thread does not know of, and it holds the lock meanwhile.
+  uint32_t refs = atomic_load_explicit(&node->refs, memory_order_relaxed);
+  while (refs > 1)
+    if (atomic_compare_exchange_weak_explicit(&node->refs, &refs, refs - 1, memory_order_release,
+                                              memory_order_relaxed))
+      return false;
+
+  pthread_mutex_lock(&intern_table.lock);
+  bool last = atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) == 1;
+  if (last)
+  {
+    size_t hash = HashNode(node);
+    INTERN_ENTRY **link = &intern_table.buckets[hash & (intern_table.bucket_count - 1)];
+    while ((*link)->node != node)
+      link = &(*link)->next;
+
+    INTERN_ENTRY *entry = *link;
+    *link = entry->next;
+    free(entry);
+    intern_table.count--;
+  }
+  pthread_mutex_unlock(&intern_table.lock);
+  return last;
+}
+
+// ---------------
+// Copying and freeing
+// ---------------
 
 AST_NODE *CopyAST(AST_NODE *node)
 {
-  AST_NODE *copy = malloc(sizeof(*copy));
+  if (node->interned)
+  {
+    stats.ast_nodes_shared++;
+    RetainInterned(node);
+    return node;
+  }
+
+  // Copies of a lazy body share it, so that it is parsed at most once.
+  if (node->kind == NODE_LAZY)
+  {
+    stats.ast_nodes_shared++;
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+    return node;
+  }
+
+  stats.ast_nodes_copied++;
+
+  AST_NODE *copy = AllocAST(sizeof(*copy));
   memcpy(copy, node, sizeof(*copy));
+  atomic_init(&copy->refs, 1);
 
   switch (node->kind)
   {
@@ -15,34 +378,71 @@ AST_NODE *CopyAST(AST_NODE *node)
     case NODE_BINARY_OPERATION:
       copy->binary_operation.left = CopyAST(node->binary_operation.left);
       copy->binary_operation.right = CopyAST(node->binary_operation.right);
+      // Copies learn about their operands afresh.
+      atomic_init(&copy->binary_operation.quick, QUICK_UNSEEN);
       break;
     case NODE_ASSIGNMENT:
-      copy->assignment.var_name = strdup(node->assignment.var_name);
+      copy->assignment.var_name =
+          CopyName(node->assignment.var_name, strlen(node->assignment.var_name));
       copy->assignment.value = CopyAST(node->assignment.value);
       break;
     case NODE_VARIABLE:
-      copy->variable = strdup(node->variable);
+      copy->variable = CopyName(node->variable, strlen(node->variable));
       break;
     case NODE_LAMBDA:
-      copy->lambda.params = CopyFnParams(node->lambda.params);
+      copy->lambda.params = CopyFnParams(node->lambda.params, node->lambda.param_count);
       copy->lambda.body = CopyAST(node->lambda.body);
       break;
     case NODE_CALL:
-      copy->call.args = CopyFnArgs(node->call.args);
+      copy->call.args = CopyFnArgs(node->call.args, node->call.arg_count);
       copy->call.fn = CopyAST(node->call.fn);
+      atomic_init(&copy->call.site, NULL);
       break;
     case NODE_IF_ELSE:
       copy->if_else.condition = CopyAST(node->if_else.condition);
       copy->if_else.if_true = CopyAST(node->if_else.if_true);
       copy->if_else.if_false = CopyAST(node->if_else.if_false);
       break;
+    case NODE_SEQUENCE:
+      copy->sequence.items = AllocAST(sizeof(AST_NODE *) * node->sequence.count);
+      for (size_t i = 0; i < node->sequence.count; i++)
+        copy->sequence.items[i] = CopyAST(node->sequence.items[i]);
+      break;
+    case NODE_LAZY:
+      // Shared instead, see above.
+      break;
+    case NODE_ARRAY:
+      copy->array.items = AllocAST(sizeof(AST_NODE *) * node->array.count);
+      for (size_t i = 0; i < node->array.count; i++)
+        copy->array.items[i] = CopyAST(node->array.items[i]);
+      break;
+    case NODE_INDEX:
+      copy->index.array = CopyAST(node->index.array);
+      copy->index.index = CopyAST(node->index.index);
+      break;
+    case NODE_PARAMETER:
+    case NODE_LOAD_TEMPORARY:
+      break;
+    case NODE_FRAME:
+      copy->frame.body = CopyAST(node->frame.body);
+      break;
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      copy->temporary.value = CopyAST(node->temporary.value);
+      break;
   }
 
-  return copy;
+  return InternAST(copy);
 }
 
 void FreeAST(AST_NODE *node)
 {
+  if (node->interned && !ReleaseInterned(node))
+    return;
+  if (!node->interned && node->kind == NODE_LAZY &&
+      atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) > 1)
+    return;
+
   switch (node->kind)
   {
     case NODE_CONSTANT_NUMBER:
@@ -53,36 +453,28 @@ void FreeAST(AST_NODE *node)
       break;
     case NODE_ASSIGNMENT:
       free(node->assignment.var_name);
-      free(node->assignment.value);
+      FreeAST(node->assignment.value);
       break;
     case NODE_VARIABLE:
       free(node->variable);
       break;
-    case NODE_LAMBDA: {
-      FN_PARAM *param = node->lambda.params;
-      while (param != NULL)
-      {
-        free(param->name);
-
-        FN_PARAM *tmp = param;
-        param = param->next;
-        free(tmp);
-      }
+    case NODE_LAMBDA:
+      FreeFnParams(node->lambda.params, node->lambda.param_count);
       if (node->lambda.body != NULL)
         FreeAST(node->lambda.body);
       break;
-    }
     case NODE_CALL: {
-      FN_ARG *arg = node->call.args;
-      while (arg != NULL)
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        FreeAST(node->call.args[i].value);
+      free(node->call.args);
+      FreeAST(node->call.fn);
+      CALL_SITE *site = atomic_load(&node->call.site);
+      if (site != NULL)
       {
-        FreeAST(arg->value);
-
-        FN_ARG *tmp = arg;
-        arg = arg->next;
-        free(tmp);
+        if (site->inlined_body != NULL)
+          FreeAST(site->inlined_body);
+        free(site);
       }
-      FreeAST(node->call.fn);
       break;
     }
     case NODE_IF_ELSE:
@@ -90,67 +482,61 @@ void FreeAST(AST_NODE *node)
       FreeAST(node->if_else.if_true);
       FreeAST(node->if_else.if_false);
       break;
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        FreeAST(node->sequence.items[i]);
+      free(node->sequence.items);
+      break;
+    case NODE_LAZY: {
+      free(node->lazy.source);
+      AST_NODE *body = atomic_load(&node->lazy.body);
+      if (body != NULL)
+        FreeAST(body);
+      break;
+    }
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        FreeAST(node->array.items[i]);
+      free(node->array.items);
+      break;
+    case NODE_INDEX:
+      FreeAST(node->index.array);
+      FreeAST(node->index.index);
+      break;
+    case NODE_PARAMETER:
+    case NODE_LOAD_TEMPORARY:
+      break;
+    case NODE_FRAME:
+      FreeAST(node->frame.body);
+      break;
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      FreeAST(node->temporary.value);
+      break;
   }
 
   free(node);
 }
 
-FN_PARAM *CopyFnParams(FN_PARAM *params)
+FN_PARAM *CopyFnParams(FN_PARAM *params, size_t count)
 {
-  FN_PARAM *copy = NULL;
-  for (FN_PARAM *param = params; param != NULL; param = param->next)
-  {
-    if (copy == NULL)
-    {
-      copy = malloc(sizeof(*copy));
-      copy->name = strdup(param->name);
-      copy->next = NULL;
-    }
-    else
-    {
-      FN_PARAM *next_copy = malloc(sizeof(*next_copy));
-      next_copy->name = strdup(param->name);
-      next_copy->next = NULL;
-      AppendFnParam(copy, next_copy);
-    }
-  }
+  FN_PARAM *copy = AllocAST(sizeof(*copy) * count);
+  for (size_t i = 0; i < count; i++)
+    copy[i].name = CopyName(params[i].name, strlen(params[i].name));
   return copy;
 }
 
-void AppendFnParam(FN_PARAM *params, FN_PARAM *new_param)
+void FreeFnParams(FN_PARAM *params, size_t count)
 {
-  FN_PARAM *last = params;
-  while (last->next != NULL)
-    last = last->next;
-  last->next = new_param;
+  for (size_t i = 0; i < count; i++)
+    free(params[i].name);
+  free(params);
 }
 
-FN_ARG *CopyFnArgs(FN_ARG *args)
+FN_ARG *CopyFnArgs(FN_ARG *args, size_t count)
 {
-  FN_ARG *copy = NULL;
-  for (FN_ARG *arg = args; arg != NULL; arg = arg->next)
-  {
-    if (copy == NULL)
-    {
-      copy = malloc(sizeof(*copy));
-      copy->value = CopyAST(arg->value);
-      copy->next = NULL;
-    }
-    else
-    {
-      FN_ARG *next_copy = malloc(sizeof(*next_copy));
-      next_copy->value = CopyAST(arg->value);
-      next_copy->next = NULL;
-      AppendFnArg(copy, next_copy);
-    }
-  }
+  FN_ARG *copy = AllocAST(sizeof(*copy) * count);
+  for (size_t i = 0; i < count; i++)
+    copy[i] = (FN_ARG){.value = CopyAST(args[i].value), .spawn = args[i].spawn};
   return copy;
 }
-
-void AppendFnArg(FN_ARG *args, FN_ARG *new_arg)
-{
-  FN_ARG *last = args;
-  while (last->next != NULL)
-    last = last->next;
-  last->next = new_arg;
-}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "lexer.h"
 
 struct AST_NODE;
@@ -10,19 +14,30 @@ typedef enum
   BINOP_SUB = TOKEN_MINUS,
   BINOP_MUL = TOKEN_STAR,
   BINOP_DIV = TOKEN_SLASH,
-  BINOP_SEQ = TOKEN_COMMA,
 } BINARY_OPERATION_KIND;
 
-typedef struct FN_PARAM
+// What a binary operation has learnt about its operands; see EvaluateBinaryOperation. The
+// number-only forms also stand for the operator, so evaluating one dispatches once.
+typedef enum
+{
+  QUICK_UNSEEN,
+  QUICK_ADD_NUMBERS,
+  QUICK_SUB_NUMBERS,
+  QUICK_MUL_NUMBERS,
+  QUICK_DIV_NUMBERS,
+  QUICK_GENERIC,
+} QUICKENED_OPERATION;
+
+typedef struct
 {
-  struct FN_PARAM *next;
   char *name;
 } FN_PARAM;
 
-typedef struct FN_ARG
+typedef struct
 {
-  struct FN_ARG *next;
   struct AST_NODE *value;
+  // Set by AnalyzeParallelCalls for arguments worth evaluating on another thread.
+  bool spawn;
 } FN_ARG;
 
 typedef enum
@@ -34,11 +49,38 @@ typedef enum
   NODE_LAMBDA,
   NODE_CALL,
   NODE_IF_ELSE,
+  NODE_SEQUENCE,
+  NODE_LAZY,
+  NODE_ARRAY,
+  NODE_INDEX,
+  NODE_PARAMETER,
+  NODE_FRAME,
+  NODE_STORE_TEMPORARY,
+  NODE_LOAD_TEMPORARY,
+  NODE_INVARIANT,
 } AST_NODE_KIND;
 
+#define AST_NODE_KIND_COUNT (NODE_INVARIANT + 1)
+
+// What EvaluateCall worked out about a call site for the first lambda called there, the one with
+// id `lambda_id`: whether the arguments can be evaluated before any parameter is bound, and the
+// body to evaluate in place of the call, its parameters replaced by NODE_PARAMETER nodes, if the
+// lambda is inlined there.
+typedef struct
+{
+  uint64_t lambda_id;
+  bool independent_args;
+  struct AST_NODE *inlined_body;
+} CALL_SITE;
+
 typedef struct AST_NODE
 {
   AST_NODE_KIND kind;
+  // Interned nodes are shared by every tree containing an equal subtree and freed once the last
+  // reference to them is released; see InternAST. Lazy bodies are shared by their copies the same
+  // way, also when sharing is off. Every node starts out with its creator's reference.
+  bool interned;
+  _Atomic uint32_t refs;
   union
   {
     double constant_number;
@@ -47,6 +89,7 @@ typedef struct AST_NODE
       struct AST_NODE *left;
       struct AST_NODE *right;
       BINARY_OPERATION_KIND op;
+      _Atomic QUICKENED_OPERATION quick;
     } binary_operation;
     struct
     {
@@ -54,15 +97,21 @@ typedef struct AST_NODE
       struct AST_NODE *value;
     } assignment;
     char *variable;
+    // Parameters, arguments and sequence items are stored as counted arrays.
     struct
     {
       FN_PARAM *params;
+      size_t param_count;
       struct AST_NODE *body;
     } lambda;
     struct
     {
       FN_ARG *args;
+      size_t arg_count;
       struct AST_NODE *fn;
+      bool parallel;
+      // Filled in when the call is first made and never replaced afterwards.
+      CALL_SITE *_Atomic site;
     } call;
     struct
     {
@@ -70,13 +119,72 @@ typedef struct AST_NODE
       struct AST_NODE *if_true;
       struct AST_NODE *if_false;
     } if_else;
+    struct
+    {
+      struct AST_NODE **items;
+      size_t count;
+    } sequence;
+    // A lambda body that has only been brace-matched. Its source is parsed when it is first
+    // evaluated, and the result is kept in `body`, for this node and every copy of it.
+    struct
+    {
+      char *source;
+      struct AST_NODE *_Atomic body;
+    } lazy;
+    // An array literal; its items are evaluated into one array value.
+    struct
+    {
+      struct AST_NODE **items;
+      size_t count;
+    } array;
+    struct
+    {
+      struct AST_NODE *array;
+      struct AST_NODE *index;
+    } index;
+    // A parameter of an inlined lambda body, read from the argument values of the call. Only
+    // found in CALL_SITE bodies, which are never interned or compacted.
+    size_t parameter;
+    // The nodes below are only found in bodies rewritten by OptimizeBody, which are never interned
+    // or compacted either. A frame evaluates its body with `slot_count` temporaries of its own.
+    struct
+    {
+      struct AST_NODE *body;
+      size_t slot_count;
+    } frame;
+    // Stores keep the result of `value` in temporary `slot` of the innermost frame and loads, which
+    // have no `value`, read it back. Invariants evaluate `value` only if neither their own frame
+    // nor the frame of the recursive call that made it holds the result yet. `call` tells the
+    // stats whether a load stands for a call.
+    struct
+    {
+      struct AST_NODE *value;
+      size_t slot;
+      bool call;
+    } temporary;
   };
 } AST_NODE;
 
+char const *ASTNodeKindName(AST_NODE_KIND kind);
+void *AllocAST(size_t size);
+char *CopyName(char const *name, size_t len);
+char *CopySource(char const *source, size_t len);
+
+// Allocates a node of the given kind whose operands are yet to be filled in.
+AST_NODE *NewASTNode(AST_NODE_KIND kind);
+// Copying an interned node only takes another reference to it; freeing one releases it.
 AST_NODE *CopyAST(AST_NODE *node);
 void FreeAST(AST_NODE *node);
 
-FN_PARAM *CopyFnParams(FN_PARAM *param);
-void AppendFnParam(FN_PARAM *params, FN_PARAM *new_param);
-FN_ARG *CopyFnArgs(FN_ARG *arg);
-void AppendFnArg(FN_ARG *args, FN_ARG *new_arg);
+// Structural sharing. While it is enabled, InternAST returns the canonical node for a completed
+// node whose children are already canonical, so equal subtrees end up as the same pointer;
+// otherwise it returns the node unchanged. The parser interns every node it builds. Interned
+// nodes must not be changed, except for flags derived from the subtree itself, the inline caches
+// of calls, which are checked against the callee, and the quickened forms of binary operations,
+// which are checked against the operands.
+void SetASTSharing(bool enabled);
+AST_NODE *InternAST(AST_NODE *node);
+
+FN_PARAM *CopyFnParams(FN_PARAM *params, size_t count);
+void FreeFnParams(FN_PARAM *params, size_t count);
+FN_ARG *CopyFnArgs(FN_ARG *args, size_t count);
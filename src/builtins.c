@@ -0,0 +1,243 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+
+// Items handed to one task by map and reduce. It is fixed rather than derived from the number of
+// workers, so that reduce combines its items in the same order on every machine.
+#define CHUNK_SIZE 1024
+
+// Bounds range() well below the point where the size of its array would overflow.
+#define RANGE_MAX_ITEMS ((double)(SIZE_MAX / sizeof(double) / 2))
+
+static void CheckFunction(INTERPRETER_STATE *state, char const *builtin, VALUE value)
+{
+  if (value.kind != VALUE_LAMBDA && value.kind != VALUE_BUILTIN)
+    RuntimeError(state, "%s: expected a function.", builtin);
+}
+
+static void CheckArray(INTERPRETER_STATE *state, char const *builtin, VALUE value)
+{
+  if (value.kind != VALUE_ARRAY)
+    RuntimeError(state, "%s: expected an array.", builtin);
+}
+
+static void CheckNumber(INTERPRETER_STATE *state, char const *builtin, VALUE value)
+{
+  if (value.kind != VALUE_NUMBER)
+    RuntimeError(state, "%s: expected a number.", builtin);
+}
+
+// Calls `fn`, which has to return a number, on numeric arguments.
+static double CallOnNumbers(INTERPRETER_STATE *state, char const *builtin, VALUE fn,
+                            double const *numbers, size_t count)
+{
+  VALUE args[BUILTIN_MAX_PARAMS];
+  for (size_t i = 0; i < count; i++)
+    args[i] = ValueNumber(numbers[i]);
+
+  VALUE result = CallFunction(state, fn, args, count);
+  if (result.kind != VALUE_NUMBER)
+  {
+    ReleaseValue(&result);
+    RuntimeError(state, "%s: the function has to return numbers.", builtin);
+  }
+  return result.number;
+}
+
+// range(start, end): the numbers start, start + 1, ... up to but excluding end.
+static VALUE Range(INTERPRETER_STATE *state, VALUE *args, void *data)
+{
+  (void)data;
+  CheckNumber(state, "range", args[0]);
+  CheckNumber(state, "range", args[1]);
+
+  double span = args[1].number - args[0].number;
+  if (!(span <= RANGE_MAX_ITEMS))
+    RuntimeError(state, "range: too many items.");
+
+  size_t count = 0;
+  if (span > 0)
+    count = (size_t)span + ((double)(size_t)span < span);
+
+  ChargeArrayMemory(state, count);
+  ARRAY *range = NewArray(count);
+  for (size_t i = 0; i < count; i++)
+    range->items[i] = args[0].number + (double)i;
+  return ValueArray(range);
+}
+
+typedef struct
+{
+  VALUE fn;
+  ARRAY const *items;
+  ARRAY *results;
+} MAP;
+
+static void MapChunk(INTERPRETER_STATE *state, size_t begin, size_t end, void *context)
+{
+  MAP *map = context;
+  for (size_t i = begin; i < end; i++)
+    map->results->items[i] = CallOnNumbers(state, "map", map->fn, &map->items->items[i], 1);
+}
+
+// map(fn, array): a new array holding fn(item) for every item.
+static VALUE Map(INTERPRETER_STATE *state, VALUE *args, void *data)
+{
+  (void)data;
+  CheckFunction(state, "map", args[0]);
+  CheckArray(state, "map", args[1]);
+
+  ARRAY const *items = args[1].array;
+  ChargeArrayMemory(state, items->count);
+  VALUE results = ValueArray(NewArray(items->count));
+  HELD_VALUES held;
+  HoldValues(state, &held, &results, 1);
+  MAP map = {.fn = args[0], .items = items, .results = results.array};
+  RunChunks(state, items->count, CHUNK_SIZE, MapChunk, &map);
+  UnholdValues(state, &held);
+  return results;
+}
+
+typedef struct
+{
+  VALUE fn;
+  ARRAY const *items;
+  ARRAY *partials;
+} REDUCE;
+
+static void ReduceChunk(INTERPRETER_STATE *state, size_t begin, size_t end, void *context)
+{
+  REDUCE *reduce = context;
+  double accumulator = reduce->items->items[begin];
+  for (size_t i = begin + 1; i < end; i++)
+  {
+    double pair[2] = {accumulator, reduce->items->items[i]};
+    accumulator = CallOnNumbers(state, "reduce", reduce->fn, pair, 2);
+  }
+  reduce->partials->items[begin / CHUNK_SIZE] = accumulator;
+}
+
+// reduce(fn, initial, array): folds the items into `initial` with fn. Every chunk is folded on its
+// own, and the results are then folded into `initial` in order, so fn has to be associative for
+// the result to match a left fold; it is the same on every run either way.
+static VALUE Reduce(INTERPRETER_STATE *state, VALUE *args, void *data)
+{
+  (void)data;
+  CheckFunction(state, "reduce", args[0]);
+  CheckNumber(state, "reduce", args[1]);
+  CheckArray(state, "reduce", args[2]);
+
+  ARRAY const *items = args[2].array;
+  size_t chunk_count = (items->count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  // An array rather than a plain buffer, so that it can be held while fn runs.
+  VALUE partials = ValueArray(NewArray(chunk_count));
+  HELD_VALUES held;
+  HoldValues(state, &held, &partials, 1);
+  REDUCE reduce = {.fn = args[0], .items = items, .partials = partials.array};
+  RunChunks(state, items->count, CHUNK_SIZE, ReduceChunk, &reduce);
+
+  double accumulator = args[1].number;
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    double pair[2] = {accumulator, partials.array->items[i]};
+    accumulator = CallOnNumbers(state, "reduce", reduce.fn, pair, 2);
+  }
+
+  UnholdValues(state, &held);
+  ReleaseValue(&partials);
+  return ValueNumber(accumulator);
+}
+
+// Math and comparisons on numbers. There are no comparison operators in tan; these return 1 for
+// true and 0 for false, which is what `if` expects.
+#define UNARY_BUILTIN(function, name, expression)                                                  \
+  static VALUE function(INTERPRETER_STATE *state, VALUE *args, void *data)                         \
+  {                                                                                                \
+    (void)data;                                                                                    \
+    CheckNumber(state, name, args[0]);                                                             \
+    double x = args[0].number;                                                                     \
+    return ValueNumber(expression);                                                                \
+  }
+
+#define BINARY_BUILTIN(function, name, expression)                                                 \
+  static VALUE function(INTERPRETER_STATE *state, VALUE *args, void *data)                         \
+  {                                                                                                \
+    (void)data;                                                                                    \
+    CheckNumber(state, name, args[0]);                                                             \
+    CheckNumber(state, name, args[1]);                                                             \
+    double x = args[0].number;                                                                     \
+    double y = args[1].number;                                                                     \
+    return ValueNumber(expression);                                                                \
+  }
+
+UNARY_BUILTIN(Sqrt, "sqrt", sqrt(x))
+UNARY_BUILTIN(Floor, "floor", floor(x))
+UNARY_BUILTIN(Ceil, "ceil", ceil(x))
+UNARY_BUILTIN(Abs, "abs", fabs(x))
+UNARY_BUILTIN(Exp, "exp", exp(x))
+UNARY_BUILTIN(Log, "log", log(x))
+UNARY_BUILTIN(Sin, "sin", sin(x))
+UNARY_BUILTIN(Cos, "cos", cos(x))
+BINARY_BUILTIN(Min, "min", fmin(x, y))
+BINARY_BUILTIN(Max, "max", fmax(x, y))
+BINARY_BUILTIN(Pow, "pow", pow(x, y))
+BINARY_BUILTIN(Less, "lt", x < y)
+BINARY_BUILTIN(LessOrEqual, "le", x <= y)
+BINARY_BUILTIN(Greater, "gt", x > y)
+BINARY_BUILTIN(GreaterOrEqual, "ge", x >= y)
+BINARY_BUILTIN(Equal, "eq", x == y)
+BINARY_BUILTIN(NotEqual, "ne", x != y)
+
+static BUILTIN const builtins[] = {
+    {.name = "range", .param_count = 2, .call = Range},
+    {.name = "map", .param_count = 2, .call = Map},
+    {.name = "reduce", .param_count = 3, .call = Reduce},
+    {.name = "sqrt", .param_count = 1, .call = Sqrt},
+    {.name = "floor", .param_count = 1, .call = Floor},
+    {.name = "ceil", .param_count = 1, .call = Ceil},
+    {.name = "abs", .param_count = 1, .call = Abs},
+    {.name = "exp", .param_count = 1, .call = Exp},
+    {.name = "log", .param_count = 1, .call = Log},
+    {.name = "sin", .param_count = 1, .call = Sin},
+    {.name = "cos", .param_count = 1, .call = Cos},
+    {.name = "min", .param_count = 2, .call = Min},
+    {.name = "max", .param_count = 2, .call = Max},
+    {.name = "pow", .param_count = 2, .call = Pow},
+    {.name = "lt", .param_count = 2, .call = Less},
+    {.name = "le", .param_count = 2, .call = LessOrEqual},
+    {.name = "gt", .param_count = 2, .call = Greater},
+    {.name = "ge", .param_count = 2, .call = GreaterOrEqual},
+    {.name = "eq", .param_count = 2, .call = Equal},
+    {.name = "ne", .param_count = 2, .call = NotEqual},
+};
+
+// Builtins added by embedders, defined after the standard ones so they can replace them.
+static struct
+{
+  BUILTIN const **builtins;
+  size_t count;
+  size_t capacity;
+} registry;
+
+bool RegisterBuiltin(BUILTIN const *builtin)
+{
+  if (builtin->param_count > BUILTIN_MAX_PARAMS)
+    return false;
+
+  if (registry.count == registry.capacity)
+  {
+    registry.capacity = registry.capacity ? registry.capacity * 2 : 8;
+    registry.builtins = realloc(registry.builtins, sizeof(*registry.builtins) * registry.capacity);
+  }
+  registry.builtins[registry.count++] = builtin;
+  return true;
+}
+
+void DefineBuiltins(INTERPRETER_STATE *state)
+{
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+    DefineGlobal(state, builtins[i].name, ValueBuiltin(&builtins[i]));
+  for (size_t i = 0; i < registry.count; i++)
+    DefineGlobal(state, registry.builtins[i]->name, ValueBuiltin(registry.builtins[i]));
+}
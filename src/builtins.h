@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "interpreter.h"
+
+// Builtins are C functions called directly by EvaluateCall: their arguments are evaluated into an
+// array on the C stack and no scope is pushed for them. Builtins registered before an interpreter
+// state is created are defined in it too; TanRegisterFunction registers embedders' functions this
+// way. `builtin` has to stay valid for as long as those states are used. Returns false if it takes
+// more than BUILTIN_MAX_PARAMS parameters.
+bool RegisterBuiltin(BUILTIN const *builtin);
+// Defines the standard and registered builtins as globals of `state`.
+void DefineBuiltins(INTERPRETER_STATE *state);
@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "image.h"
+#include "parser.h"
+
+uint64_t HashSource(char const *source)
+{
+  uint64_t hash = 14695981039346656037u;
+  for (unsigned char const *c = (unsigned char const *)source; *c != 0; c++)
+  {
+    hash ^= *c;
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+static char *CachePath(char const *cache_dir, uint64_t hash)
+{
+  size_t len = snprintf(NULL, 0, "%s/%016llx.tanc", cache_dir, (unsigned long long)hash);
+  char *path = malloc(len + 1);
+  snprintf(path, len + 1, "%s/%016llx.tanc", cache_dir, (unsigned long long)hash);
+  return path;
+}
+
+AST_NODE *ParseProgramCached(char const *source, char const *cache_dir)
+{
+  uint64_t hash = HashSource(source);
+  char *path = CachePath(cache_dir, hash);
+
+  size_t root_count;
+  IMAGE_ROOT *roots = ReadImage(path, IMAGE_PROGRAM, hash, &root_count);
+  if (roots != NULL)
+  {
+    AST_NODE *program = root_count == 1 ? roots[0].node : NULL;
+    if (program == NULL)
+      for (size_t i = 0; i < root_count; i++)
+        FreeAST(roots[i].node);
+    FreeImageRoots(roots, root_count);
+    if (program != NULL)
+    {
+      free(path);
+      return program;
+    }
+  }
+
+  AST_NODE *program = ParseProgram(source);
+  if (program != NULL && (mkdir(cache_dir, 0777) == 0 || errno == EEXIST))
+  {
+    IMAGE_ROOT root = {.name = NULL, .node = program};
+    // A failure to store the program only costs the next run a parse.
+    WriteImage(path, IMAGE_PROGRAM, hash, &root, 1);
+  }
+
+  free(path);
+  return program;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ast.h"
+
+// Program cache. Parsed programs are stored as images named after a hash of their source, so an
+// edited script simply misses the cache and is parsed and stored again.
+uint64_t HashSource(char const *source);
+// Like ParseProgram, but loads the program from `cache_dir` if it was parsed before.
+AST_NODE *ParseProgramCached(char const *source, char const *cache_dir);
@@ -0,0 +1,441 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compact.h"
+#include "stats.h"
+
+// The header is followed by the numbers, the operands (three per node), the lists, the kinds and
+// the names, in that order, so that every table is naturally aligned.
+struct COMPACT_AST
+{
+  uint32_t node_count;
+  uint32_t number_count;
+  uint32_t list_count;
+  uint32_t name_bytes;
+  uint64_t size;
+  uint64_t reserved;
+};
+
+// What a, b and c hold depends on the kind:
+//   constant number    a = number
+//   binary operation   a = left, b = right, c = operator
+//   assignment         a = name, b = value
+//   variable           a = name
+//   lambda             a = list of parameter names, b = body, c = parameter count
+//   call               a = function, b = list of arguments, c = argument count
+//   if-else            a = condition, b = if true, c = if false
+//   sequence           a = list of items, c = item count
+//   lazy body          a = source, kept in the name table
+#define OPERANDS_PER_NODE 3
+
+static double const *Numbers(COMPACT_AST const *ast)
+{
+  return (double const *)(ast + 1);
+}
+
+static uint32_t const *Operands(COMPACT_AST const *ast)
+{
+  return (uint32_t const *)(Numbers(ast) + ast->number_count);
+}
+
+static uint32_t const *Lists(COMPACT_AST const *ast)
+{
+  return Operands(ast) + (size_t)ast->node_count * OPERANDS_PER_NODE;
+}
+
+static uint8_t const *Kinds(COMPACT_AST const *ast)
+{
+  return (uint8_t const *)(Lists(ast) + ast->list_count);
+}
+
+static char const *Names(COMPACT_AST const *ast)
+{
+  return (char const *)(Kinds(ast) + ast->node_count);
+}
+
+static size_t SizeFor(size_t node_count, size_t number_count, size_t list_count,
+                      size_t name_bytes)
+{
+  return sizeof(COMPACT_AST) + sizeof(double) * number_count +
+         sizeof(uint32_t) * OPERANDS_PER_NODE * node_count + sizeof(uint32_t) * list_count +
+         node_count + name_bytes;
+}
+
+static void *Grow(void *data, size_t *capacity, size_t needed, size_t element_size)
+{
+  if (needed <= *capacity)
+    return data;
+  while (*capacity < needed)
+    *capacity = *capacity ? *capacity * 2 : 64;
+  return realloc(data, *capacity * element_size);
+}
+
+uint32_t AddCompactName(COMPACT_BUILDER *builder, char const *name)
+{
+  size_t len = strlen(name) + 1;
+  builder->names = Grow(builder->names, &builder->name_capacity, builder->name_bytes + len, 1);
+  memcpy(builder->names + builder->name_bytes, name, len);
+  builder->name_bytes += len;
+  return builder->name_bytes - len;
+}
+
+static uint32_t AddNumber(COMPACT_BUILDER *builder, double number)
+{
+  builder->numbers = Grow(builder->numbers, &builder->number_capacity,
+                          builder->number_count + 1, sizeof(double));
+  builder->numbers[builder->number_count] = number;
+  return builder->number_count++;
+}
+
+static uint32_t AddList(COMPACT_BUILDER *builder, uint32_t const *entries, size_t count)
+{
+  builder->lists = Grow(builder->lists, &builder->list_capacity, builder->list_count + count,
+                        sizeof(uint32_t));
+  if (count > 0)
+    memcpy(builder->lists + builder->list_count, entries, sizeof(uint32_t) * count);
+  builder->list_count += count;
+  return builder->list_count - count;
+}
+
+static uint32_t AddNode(COMPACT_BUILDER *builder, AST_NODE_KIND kind, uint32_t a, uint32_t b,
+                        uint32_t c)
+{
+  // Kinds and operands always grow together, so they share node_capacity.
+  size_t count = builder->node_count + 1;
+  size_t capacity = builder->node_capacity;
+  builder->kinds = Grow(builder->kinds, &capacity, count, sizeof(uint8_t));
+  builder->operands = Grow(builder->operands, &builder->node_capacity, count,
+                           sizeof(uint32_t) * OPERANDS_PER_NODE);
+
+  builder->kinds[builder->node_count] = kind;
+  uint32_t *operands = &builder->operands[builder->node_count * OPERANDS_PER_NODE];
+  operands[0] = a;
+  operands[1] = b;
+  operands[2] = c;
+  return builder->node_count++;
+}
+
+uint32_t AddCompactNode(COMPACT_BUILDER *builder, AST_NODE *node)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      return AddNode(builder, node->kind, AddNumber(builder, node->constant_number), 0, 0);
+    case NODE_BINARY_OPERATION: {
+      uint32_t left = AddCompactNode(builder, node->binary_operation.left);
+      uint32_t right = AddCompactNode(builder, node->binary_operation.right);
+      return AddNode(builder, node->kind, left, right, node->binary_operation.op);
+    }
+    case NODE_ASSIGNMENT: {
+      uint32_t value = AddCompactNode(builder, node->assignment.value);
+      uint32_t name = AddCompactName(builder, node->assignment.var_name);
+      return AddNode(builder, node->kind, name, value, 0);
+    }
+    case NODE_VARIABLE:
+      return AddNode(builder, node->kind, AddCompactName(builder, node->variable), 0, 0);
+    case NODE_LAMBDA: {
+      size_t count = node->lambda.param_count;
+      uint32_t *names = malloc(sizeof(uint32_t) * (count + 1));
+      for (size_t i = 0; i < count; i++)
+        names[i] = AddCompactName(builder, node->lambda.params[i].name);
+      uint32_t params = AddList(builder, names, count);
+      free(names);
+      uint32_t body = AddCompactNode(builder, node->lambda.body);
+      return AddNode(builder, node->kind, params, body, count);
+    }
+    case NODE_CALL: {
+      size_t count = node->call.arg_count;
+      uint32_t *args = malloc(sizeof(uint32_t) * (count + 1));
+      for (size_t i = 0; i < count; i++)
+        args[i] = AddCompactNode(builder, node->call.args[i].value);
+      uint32_t fn = AddCompactNode(builder, node->call.fn);
+      uint32_t list = AddList(builder, args, count);
+      free(args);
+      return AddNode(builder, node->kind, fn, list, count);
+    }
+    case NODE_IF_ELSE: {
+      uint32_t condition = AddCompactNode(builder, node->if_else.condition);
+      uint32_t if_true = AddCompactNode(builder, node->if_else.if_true);
+      uint32_t if_false = AddCompactNode(builder, node->if_else.if_false);
+      return AddNode(builder, node->kind, condition, if_true, if_false);
+    }
+    case NODE_SEQUENCE: {
+      size_t count = node->sequence.count;
+      uint32_t *items = malloc(sizeof(uint32_t) * (count + 1));
+      for (size_t i = 0; i < count; i++)
+        items[i] = AddCompactNode(builder, node->sequence.items[i]);
+      uint32_t list = AddList(builder, items, count);
+      free(items);
+      return AddNode(builder, node->kind, list, 0, count);
+    }
+    case NODE_LAZY: {
+      AST_NODE *body = atomic_load(&node->lazy.body);
+      if (body != NULL)
+        return AddCompactNode(builder, body);
+      return AddNode(builder, node->kind, AddCompactName(builder, node->lazy.source), 0, 0);
+    }
+    case NODE_ARRAY: {
+      size_t count = node->array.count;
+      uint32_t *items = malloc(sizeof(uint32_t) * (count + 1));
+      for (size_t i = 0; i < count; i++)
+        items[i] = AddCompactNode(builder, node->array.items[i]);
+      uint32_t list = AddList(builder, items, count);
+      free(items);
+      return AddNode(builder, node->kind, list, 0, count);
+    }
+    case NODE_INDEX: {
+      uint32_t array = AddCompactNode(builder, node->index.array);
+      uint32_t index = AddCompactNode(builder, node->index.index);
+      return AddNode(builder, node->kind, array, index, 0);
+    }
+    case NODE_PARAMETER:
+      assert(!"AddCompactNode: inlined bodies are not compacted");
+      break;
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      assert(!"AddCompactNode: optimized bodies are not compacted");
+      break;
+  }
+
+  return AddNode(builder, node->kind, 0, 0, 0);
+}
+
+// Copies a table into a new compact AST at `*end` and moves `*end` past it.
+static void AppendTable(unsigned char **end, void const *data, size_t bytes)
+{
+  if (bytes > 0)
+    memcpy(*end, data, bytes);
+  *end += bytes;
+}
+
+COMPACT_AST *FinishCompactAST(COMPACT_BUILDER *builder)
+{
+  size_t size = SizeFor(builder->node_count, builder->number_count, builder->list_count,
+                        builder->name_bytes);
+  COUNT_ALLOCATION(STATS_MEMORY_COMPACT_AST, size);
+  COMPACT_AST *ast = malloc(size);
+  *ast = (COMPACT_AST){
+      .node_count = builder->node_count,
+      .number_count = builder->number_count,
+      .list_count = builder->list_count,
+      .name_bytes = builder->name_bytes,
+      .size = size,
+  };
+
+  // The tables follow the header in the order the accessors expect them.
+  unsigned char *end = (unsigned char *)(ast + 1);
+  AppendTable(&end, builder->numbers, sizeof(double) * builder->number_count);
+  AppendTable(&end, builder->operands, sizeof(uint32_t) * OPERANDS_PER_NODE * builder->node_count);
+  AppendTable(&end, builder->lists, sizeof(uint32_t) * builder->list_count);
+  AppendTable(&end, builder->kinds, builder->node_count);
+  AppendTable(&end, builder->names, builder->name_bytes);
+  assert(end == (unsigned char *)ast + size);
+
+  free(builder->kinds);
+  free(builder->operands);
+  free(builder->numbers);
+  free(builder->lists);
+  free(builder->names);
+  *builder = (COMPACT_BUILDER){0};
+  return ast;
+}
+
+void FreeCompactAST(COMPACT_AST *ast)
+{
+  free(ast);
+}
+
+size_t CompactASTSize(COMPACT_AST const *ast)
+{
+  return ast->size;
+}
+
+uint32_t CompactASTNodeCount(COMPACT_AST const *ast)
+{
+  return ast->node_count;
+}
+
+char const *CompactASTName(COMPACT_AST const *ast, uint32_t offset)
+{
+  return offset < ast->name_bytes ? Names(ast) + offset : NULL;
+}
+
+static bool ValidList(COMPACT_AST const *ast, uint32_t start, uint32_t count)
+{
+  return start <= ast->list_count && count <= ast->list_count - start;
+}
+
+static bool ValidBinaryOperation(uint32_t op)
+{
+  switch ((BINARY_OPERATION_KIND)op)
+  {
+    case BINOP_ADD:
+    case BINOP_SUB:
+    case BINOP_MUL:
+    case BINOP_DIV:
+      return true;
+  }
+
+  return false;
+}
+
+// A node is valid if everything it refers to is in bounds and its children come before it, which
+// also rules out cycles.
+static bool ValidNode(COMPACT_AST const *ast, uint32_t index)
+{
+  uint32_t const *operands = &Operands(ast)[(size_t)index * OPERANDS_PER_NODE];
+  uint32_t a = operands[0], b = operands[1], c = operands[2];
+  uint32_t const *lists = Lists(ast);
+
+  switch ((AST_NODE_KIND)Kinds(ast)[index])
+  {
+    case NODE_CONSTANT_NUMBER:
+      return a < ast->number_count;
+    case NODE_BINARY_OPERATION:
+      return a < index && b < index && ValidBinaryOperation(c);
+    case NODE_ASSIGNMENT:
+      return a < ast->name_bytes && b < index;
+    case NODE_VARIABLE:
+      return a < ast->name_bytes;
+    case NODE_LAMBDA:
+      if (!ValidList(ast, a, c) || b >= index)
+        return false;
+      for (uint32_t i = 0; i < c; i++)
+        if (lists[a + i] >= ast->name_bytes)
+          return false;
+      return true;
+    case NODE_CALL:
+      if (!ValidList(ast, b, c) || a >= index)
+        return false;
+      for (uint32_t i = 0; i < c; i++)
+        if (lists[b + i] >= index)
+          return false;
+      return true;
+    case NODE_IF_ELSE:
+      return a < index && b < index && c < index;
+    case NODE_SEQUENCE:
+    case NODE_ARRAY:
+      if (!ValidList(ast, a, c))
+        return false;
+      for (uint32_t i = 0; i < c; i++)
+        if (lists[a + i] >= index)
+          return false;
+      return true;
+    case NODE_LAZY:
+      return a < ast->name_bytes;
+    case NODE_INDEX:
+      return a < index && b < index;
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      return false;
+  }
+
+  return false;
+}
+
+COMPACT_AST const *ViewCompactAST(void const *data, size_t size)
+{
+  COMPACT_AST const *ast = data;
+  if (size < sizeof(*ast) || ast->size != size ||
+      SizeFor(ast->node_count, ast->number_count, ast->list_count, ast->name_bytes) != size)
+    return NULL;
+
+  if (ast->name_bytes > 0 && Names(ast)[ast->name_bytes - 1] != 0)
+    return NULL;
+  for (uint32_t i = 0; i < ast->node_count; i++)
+    if (!ValidNode(ast, i))
+      return NULL;
+
+  return ast;
+}
+
+static char *ExpandName(COMPACT_AST const *ast, uint32_t offset)
+{
+  char const *name = Names(ast) + offset;
+  return CopyName(name, strlen(name));
+}
+
+AST_NODE *ExpandCompactAST(COMPACT_AST const *ast, uint32_t index)
+{
+  uint32_t const *operands = &Operands(ast)[(size_t)index * OPERANDS_PER_NODE];
+  uint32_t a = operands[0], b = operands[1], c = operands[2];
+  uint32_t const *lists = Lists(ast);
+
+  AST_NODE *node = NewASTNode(Kinds(ast)[index]);
+
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      node->constant_number = Numbers(ast)[a];
+      break;
+    case NODE_BINARY_OPERATION:
+      node->binary_operation.left = ExpandCompactAST(ast, a);
+      node->binary_operation.right = ExpandCompactAST(ast, b);
+      node->binary_operation.op = c;
+      atomic_init(&node->binary_operation.quick, QUICK_UNSEEN);
+      break;
+    case NODE_ASSIGNMENT:
+      node->assignment.var_name = ExpandName(ast, a);
+      node->assignment.value = ExpandCompactAST(ast, b);
+      break;
+    case NODE_VARIABLE:
+      node->variable = ExpandName(ast, a);
+      break;
+    case NODE_LAMBDA:
+      node->lambda.param_count = c;
+      node->lambda.params = AllocAST(sizeof(FN_PARAM) * c);
+      for (uint32_t i = 0; i < c; i++)
+        node->lambda.params[i].name = ExpandName(ast, lists[a + i]);
+      node->lambda.body = ExpandCompactAST(ast, b);
+      break;
+    case NODE_CALL:
+      node->call.arg_count = c;
+      node->call.args = AllocAST(sizeof(FN_ARG) * c);
+      for (uint32_t i = 0; i < c; i++)
+        node->call.args[i] = (FN_ARG){.value = ExpandCompactAST(ast, lists[b + i])};
+      node->call.fn = ExpandCompactAST(ast, a);
+      node->call.parallel = false;
+      atomic_init(&node->call.site, NULL);
+      break;
+    case NODE_IF_ELSE:
+      node->if_else.condition = ExpandCompactAST(ast, a);
+      node->if_else.if_true = ExpandCompactAST(ast, b);
+      node->if_else.if_false = ExpandCompactAST(ast, c);
+      break;
+    case NODE_SEQUENCE:
+      node->sequence.count = c;
+      node->sequence.items = AllocAST(sizeof(AST_NODE *) * c);
+      for (uint32_t i = 0; i < c; i++)
+        node->sequence.items[i] = ExpandCompactAST(ast, lists[a + i]);
+      break;
+    case NODE_LAZY:
+      node->lazy.source = CopySource(Names(ast) + a, strlen(Names(ast) + a));
+      atomic_init(&node->lazy.body, NULL);
+      break;
+    case NODE_ARRAY:
+      node->array.count = c;
+      node->array.items = AllocAST(sizeof(AST_NODE *) * c);
+      for (uint32_t i = 0; i < c; i++)
+        node->array.items[i] = ExpandCompactAST(ast, lists[a + i]);
+      break;
+    case NODE_INDEX:
+      node->index.array = ExpandCompactAST(ast, a);
+      node->index.index = ExpandCompactAST(ast, b);
+      break;
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      // Rejected by ValidNode.
+      break;
+  }
+
+  return InternAST(node);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+// Compact ASTs hold a whole tree in one contiguous, position-independent buffer: node kinds are
+// kept in their own byte array, children are 32-bit indices, and numbers, lists and names live in
+// side tables. Children always come before their parents, so every walk over the nodes in order
+// visits them bottom-up.
+//
+// This is a serialization format only: images are written in it, and ExpandCompactAST turns them
+// back into pointer trees before anything is evaluated. Programs in memory are never held in
+// compact form, so copying and freeing them still walks their nodes one by one.
+typedef struct COMPACT_AST COMPACT_AST;
+
+typedef struct
+{
+  uint8_t *kinds;
+  uint32_t *operands;
+  size_t node_count;
+  size_t node_capacity;
+  double *numbers;
+  size_t number_count;
+  size_t number_capacity;
+  uint32_t *lists;
+  size_t list_count;
+  size_t list_capacity;
+  char *names;
+  size_t name_bytes;
+  size_t name_capacity;
+} COMPACT_BUILDER;
+
+// Appends `node` and its subtree to the builder and returns the index of `node`.
+uint32_t AddCompactNode(COMPACT_BUILDER *builder, AST_NODE *node);
+// Adds a name to the builder's name table and returns its offset.
+uint32_t AddCompactName(COMPACT_BUILDER *builder, char const *name);
+// Releases the builder's tables once they have been packed into the returned buffer.
+COMPACT_AST *FinishCompactAST(COMPACT_BUILDER *builder);
+
+void FreeCompactAST(COMPACT_AST *ast);
+
+size_t CompactASTSize(COMPACT_AST const *ast);
+uint32_t CompactASTNodeCount(COMPACT_AST const *ast);
+// Returns NULL if `offset` lies outside the name table.
+char const *CompactASTName(COMPACT_AST const *ast, uint32_t offset);
+
+// Checks that `size` bytes at `data`, which must be 8-byte aligned, form a compact AST whose
+// references are all in bounds, and returns it, or NULL if they do not.
+COMPACT_AST const *ViewCompactAST(void const *data, size_t size);
+// Rebuilds the pointer-based tree rooted at `index`.
+AST_NODE *ExpandCompactAST(COMPACT_AST const *ast, uint32_t index);
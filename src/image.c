@@ -0,0 +1,149 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compact.h"
+#include "image.h"
+
+#define IMAGE_MAGIC 0x434e4154u // "TANC"
+// Bumped whenever the parser builds different trees for the same source or the node layout
+// changes, so that cached programs from older versions are parsed again.
+#define IMAGE_VERSION 5u
+
+// An image is a header, a root table and a compact AST holding the roots' trees and names.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t kind;
+  uint32_t root_count;
+  uint64_t key;
+  uint64_t ast_size;
+} IMAGE_HEADER;
+
+typedef struct
+{
+  // Offset of the root's name in the compact AST's name table, or IMAGE_NO_NAME.
+  uint32_t name;
+  uint32_t node;
+} IMAGE_ROOT_ENTRY;
+
+#define IMAGE_NO_NAME UINT32_MAX
+
+bool WriteImage(char const *path, IMAGE_KIND kind, uint64_t key, IMAGE_ROOT const *roots,
+                size_t root_count)
+{
+  COMPACT_BUILDER builder = {0};
+  IMAGE_ROOT_ENTRY *entries = malloc(sizeof(*entries) * (root_count + 1));
+  for (size_t i = 0; i < root_count; i++)
+  {
+    entries[i].name = roots[i].name ? AddCompactName(&builder, roots[i].name) : IMAGE_NO_NAME;
+    entries[i].node = AddCompactNode(&builder, roots[i].node);
+  }
+  COMPACT_AST *ast = FinishCompactAST(&builder);
+
+  IMAGE_HEADER header = {
+      .magic = IMAGE_MAGIC,
+      .version = IMAGE_VERSION,
+      .kind = kind,
+      .root_count = root_count,
+      .key = key,
+      .ast_size = CompactASTSize(ast),
+  };
+
+  // Written under a temporary name and renamed, so readers never see a half-written image.
+  size_t tmp_path_len = strlen(path) + 16;
+  char *tmp_path = malloc(tmp_path_len);
+  snprintf(tmp_path, tmp_path_len, "%s.%ld.tmp", path, (long)getpid());
+
+  bool ok = false;
+  FILE *file = fopen(tmp_path, "wb");
+  if (file != NULL)
+  {
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(entries, sizeof(*entries), root_count, file) == root_count &&
+         fwrite(ast, 1, header.ast_size, file) == header.ast_size;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok)
+      remove(tmp_path);
+  }
+
+  free(tmp_path);
+  free(entries);
+  FreeCompactAST(ast);
+  return ok;
+}
+
+static IMAGE_ROOT *ReadMappedImage(unsigned char const *data, size_t size, IMAGE_KIND kind,
+                                   uint64_t key, size_t *root_count)
+{
+  IMAGE_HEADER header;
+  if (size < sizeof(header))
+    return NULL;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION || header.kind != kind ||
+      header.key != key)
+    return NULL;
+
+  // The header and root entries are multiples of 8 bytes, so the compact AST is aligned for use
+  // in place.
+  size_t ast_offset = sizeof(header) + sizeof(IMAGE_ROOT_ENTRY) * (size_t)header.root_count;
+  if (ast_offset > size || size - ast_offset != header.ast_size)
+    return NULL;
+
+  IMAGE_ROOT_ENTRY const *entries = (IMAGE_ROOT_ENTRY const *)(data + sizeof(header));
+  COMPACT_AST const *ast = ViewCompactAST(data + ast_offset, header.ast_size);
+  if (ast == NULL)
+    return NULL;
+  for (uint32_t i = 0; i < header.root_count; i++)
+    if (entries[i].node >= CompactASTNodeCount(ast) ||
+        (entries[i].name != IMAGE_NO_NAME && CompactASTName(ast, entries[i].name) == NULL))
+      return NULL;
+
+  IMAGE_ROOT *roots = malloc(sizeof(*roots) * (header.root_count + 1));
+  for (uint32_t i = 0; i < header.root_count; i++)
+  {
+    char const *name =
+        entries[i].name != IMAGE_NO_NAME ? CompactASTName(ast, entries[i].name) : NULL;
+    roots[i].name = name != NULL ? CopyName(name, strlen(name)) : NULL;
+    roots[i].node = ExpandCompactAST(ast, entries[i].node);
+  }
+
+  *root_count = header.root_count;
+  return roots;
+}
+
+IMAGE_ROOT *ReadImage(char const *path, IMAGE_KIND kind, uint64_t key, size_t *root_count)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  IMAGE_ROOT *roots = ReadMappedImage(data, st.st_size, kind, key, root_count);
+  munmap(data, st.st_size);
+  return roots;
+}
+
+void FreeImageRoots(IMAGE_ROOT *roots, size_t root_count)
+{
+  for (size_t i = 0; i < root_count; i++)
+    free(roots[i].name);
+  free(roots);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+// Images store ASTs on disk in a flat, position-independent form: nodes refer to each other and to
+// their names by index, so a file can be mapped and read back without any lexing or parsing. An
+// image holds a list of roots, optionally named, and is tagged with a kind and a key so that
+// stale images can be told apart from current ones.
+//
+// Images are not evaluated in place. ReadImage maps the file, checks it and expands every root into
+// ordinary AST nodes, so loading skips lexing and parsing but still allocates the whole tree. No
+// part of the interpreter evaluates the compact form directly.
+typedef enum
+{
+  IMAGE_PROGRAM = 1,
+  IMAGE_SNAPSHOT = 2,
+} IMAGE_KIND;
+
+typedef struct
+{
+  char *name;
+  AST_NODE *node;
+} IMAGE_ROOT;
+
+bool WriteImage(char const *path, IMAGE_KIND kind, uint64_t key, IMAGE_ROOT const *roots,
+                size_t root_count);
+// Returns NULL if the file is missing, of another kind or key, or corrupt. The caller owns the
+// returned nodes; FreeImageRoots releases the rest.
+IMAGE_ROOT *ReadImage(char const *path, IMAGE_KIND kind, uint64_t key, size_t *root_count);
+void FreeImageRoots(IMAGE_ROOT *roots, size_t root_count);
@@ -1,34 +1,163 @@
 #include <assert.h>
-#include <stdbool.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "builtins.h"
 #include "interpreter.h"
+#include "stats.h"
+#include "trace.h"
 #include "unreachable.h"
 
 static void PushNewScope(INTERPRETER_STATE *state);
 static void PopScope(INTERPRETER_STATE *state);
+static VALUE EvaluateNode(INTERPRETER_STATE *state, AST_NODE *node);
+static bool TryEvaluate(INTERPRETER_STATE *state, AST_NODE *node, VALUE *result);
+static bool HasAssignment(AST_NODE *node, bool temporaries);
+static AST_NODE *LambdaCode(INTERPRETER_STATE *state, LAMBDA *lambda);
+static void PopWindow(INTERPRETER_STATE *state);
+static void PopFrame(INTERPRETER_STATE *state);
+
+// FNV-1a, as for source hashes in the parse cache.
+static size_t HashName(char const *name)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (; *name != '\0'; name++)
+    hash = (hash ^ (unsigned char)*name) * 0x100000001b3ULL;
+  return (size_t)hash;
+}
+
+#define GLOBAL_SCOPE_INITIAL_CAPACITY 256
 
 INTERPRETER_STATE NewInterpreterState(size_t variables_per_scope)
 {
   INTERPRETER_STATE state = (INTERPRETER_STATE){
       .current_scope = NULL,
+      .window = NULL,
+      .frame = NULL,
+      .held = NULL,
       .variables_per_scope = variables_per_scope,
+      .call_stack = {.depth = 0},
+      .error_handler = NULL,
+      .error = "",
+      .pool = NULL,
+      .parallel_args_threshold = 0,
+      .optimize = false,
+      .yield_countdown = YIELD_CHECK_INTERVAL,
+      .yield = NULL,
+      .yield_context = NULL,
+      .inline_args = NULL,
+      .fuel_limit = SIZE_MAX,
+      .fuel = SIZE_MAX,
+      .memory_limit = SIZE_MAX,
+      .scope_memory = 0,
+      .lambda_memory = 0,
+      .array_memory = 0,
   };
   PushNewScope(&state);
+  state.current_scope->hashed = true;
+  DefineBuiltins(&state);
   return state;
 }
 
+void CopySettings(INTERPRETER_STATE *state, INTERPRETER_STATE const *settings)
+{
+  state->pool = settings->pool;
+  state->parallel_args_threshold = settings->parallel_args_threshold;
+  state->optimize = settings->optimize;
+  state->fuel_limit = settings->fuel_limit;
+  state->memory_limit = settings->memory_limit;
+}
+
 void FreeInterpreterState(INTERPRETER_STATE *state)
 {
   while (state->current_scope != NULL)
     PopScope(state);
 }
 
+_Noreturn void RuntimeError(INTERPRETER_STATE *state, char const *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vsnprintf(state->error, sizeof(state->error), format, args);
+  va_end(args);
+
+  ERROR_HANDLER *handler = state->error_handler;
+  assert(handler != NULL && "RuntimeError: no evaluation in progress");
+  while (state->window != handler->window)
+    PopWindow(state);
+  while (state->frame != handler->frame)
+    PopFrame(state);
+  while (state->held != handler->held)
+  {
+    HELD_VALUES *held = state->held;
+    state->held = held->outer;
+    for (size_t i = 0; i < held->count; i++)
+      ReleaseValue(&held->values[i]);
+  }
+  // Every call frame has a begin event open, which the calls being abandoned no longer end.
+  CALL_STACK *stack = &state->call_stack;
+  while (stack->depth > handler->call_depth)
+  {
+    stack->depth--;
+    TRACE_END(stack->depth < CALL_STACK_MAX_FRAMES ? stack->frames[stack->depth] : "<deep>");
+  }
+  longjmp(handler->jump, 1);
+}
+
+void HoldValues(INTERPRETER_STATE *state, HELD_VALUES *held, VALUE *values, size_t count)
+{
+  *held = (HELD_VALUES){.outer = state->held, .values = values, .count = count};
+  state->held = held;
+}
+
+void UnholdValues(INTERPRETER_STATE *state, HELD_VALUES *held)
+{
+  assert(state->held == held && "UnholdValues: holds have to end in reverse order");
+  state->held = held->outer;
+}
+
+static void ResizeScope(INTERPRETER_STATE *state, SCOPE *scope, size_t capacity)
+{
+  size_t old_size = sizeof(VARIABLE) * scope->capacity;
+  size_t new_size = sizeof(VARIABLE) * capacity;
+  COUNT_ALLOCATION(STATS_MEMORY_SCOPES, new_size);
+  state->scope_memory += new_size - old_size;
+
+  VARIABLE *variables = calloc(capacity, sizeof(VARIABLE));
+  if (scope->hashed)
+  {
+    // Rehash every variable into the new table.
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < scope->capacity; i++)
+    {
+      VARIABLE *var = &scope->variables[i];
+      if (var->name == NULL)
+        continue;
+
+      size_t slot = HashName(var->name) & mask;
+      while (variables[slot].name != NULL)
+        slot = (slot + 1) & mask;
+      variables[slot] = *var;
+    }
+  }
+  else if (scope->count > 0)
+    memcpy(variables, scope->variables, sizeof(VARIABLE) * scope->count);
+
+  free(scope->variables);
+  scope->variables = variables;
+  scope->capacity = capacity;
+}
+
 static void PushNewScope(INTERPRETER_STATE *state)
 {
+  stats.scopes_pushed++;
+  COUNT_ALLOCATION(STATS_MEMORY_SCOPES, sizeof(SCOPE));
+  state->scope_memory += sizeof(SCOPE);
+
   SCOPE *new_scope = malloc(sizeof(*new_scope));
-  new_scope->upper_scope = state->current_scope;
-  new_scope->variables = malloc(sizeof(VARIABLE) * state->variables_per_scope);
+  *new_scope = (SCOPE){.upper_scope = state->current_scope};
   state->current_scope = new_scope;
 }
 
@@ -37,61 +166,180 @@ static void PopScope(INTERPRETER_STATE *state)
   SCOPE *current_scope = state->current_scope;
   SCOPE *upper_scope = current_scope->upper_scope;
 
-  for (size_t i = 0; i < state->variables_per_scope; i++)
+  stats.scopes_popped++;
+  state->scope_memory -= sizeof(SCOPE) + sizeof(VARIABLE) * current_scope->capacity;
+
+  for (size_t i = 0; i < current_scope->capacity; i++)
   {
     VARIABLE *var = &current_scope->variables[i];
     if (var->name != NULL)
     {
       free(var->name);
-      FreeValue(&var->value);
+      ReleaseValue(&var->value);
     }
   }
+  ReleaseValue(&current_scope->callee);
   free(current_scope->variables);
   free(current_scope);
 
   state->current_scope = upper_scope;
 }
 
-static void SetVariable(INTERPRETER_STATE *state, char const *name, VALUE value)
+// Returns the slot holding `name` in `scope`, or NULL if there is none. Probes of the global
+// table and slots of function scopes both count as scanned slots.
+static VARIABLE *FindVariable(SCOPE *scope, char const *name)
 {
-  for (size_t i = 0; i < state->variables_per_scope; i++)
+  if (scope->hashed)
   {
-    VARIABLE *var = &state->current_scope->variables[i];
-    if (var->name != NULL && strcmp(var->name, name) == 0)
+    if (scope->count == 0)
+      return NULL;
+
+    size_t mask = scope->capacity - 1;
+    for (size_t slot = HashName(name) & mask;; slot = (slot + 1) & mask)
     {
-      var->value = value;
-      return;
+      stats.variable_slots_scanned++;
+      VARIABLE *var = &scope->variables[slot];
+      if (var->name == NULL)
+        return NULL;
+      if (strcmp(var->name, name) == 0)
+        return var;
     }
   }
 
-  for (size_t i = 0; i < state->variables_per_scope; i++)
+  for (size_t i = 0; i < scope->count; i++)
   {
-    VARIABLE *var = &state->current_scope->variables[i];
-    if (var->name == NULL)
+    VARIABLE *var = &scope->variables[i];
+    if (strcmp(var->name, name) == 0)
     {
-      var->name = strdup(name);
-      var->value = value;
-      return;
+      stats.variable_slots_scanned += i + 1;
+      return var;
     }
   }
+  stats.variable_slots_scanned += scope->count;
+  return NULL;
+}
+
+// Adds `name`, which must not be in `scope` yet, growing the scope if it is full.
+static VARIABLE *AddVariable(INTERPRETER_STATE *state, SCOPE *scope, char const *name)
+{
+  VARIABLE *var;
+  if (scope->hashed)
+  {
+    // Keep the table at most three quarters full so that probe sequences stay short.
+    if ((scope->count + 1) * 4 > scope->capacity * 3)
+      ResizeScope(state, scope,
+                  scope->capacity == 0 ? GLOBAL_SCOPE_INITIAL_CAPACITY : scope->capacity * 2);
+
+    size_t mask = scope->capacity - 1;
+    size_t slot = HashName(name) & mask;
+    while (scope->variables[slot].name != NULL)
+      slot = (slot + 1) & mask;
+    var = &scope->variables[slot];
+  }
+  else
+  {
+    if (scope->count == scope->capacity)
+      ResizeScope(state, scope,
+                  scope->capacity == 0 ? state->variables_per_scope : scope->capacity * 2);
+    var = &scope->variables[scope->count];
+  }
 
-  assert(!"SetVariable: out of free variables.");
+  scope->count++;
+  var->name = CopyName(name, strlen(name));
+  return var;
 }
 
-static VALUE GetVariable(INTERPRETER_STATE *state, char const *name)
+// Returns the slot holding the parameter `name` in `window`. A name bound twice refers to the later
+// parameter, as in a scope.
+static VALUE *FindInWindow(LEAF_WINDOW *window, char const *name)
 {
-  for (SCOPE *scope = state->current_scope; scope != NULL; scope = scope->upper_scope)
-    for (size_t i = 0; i < state->variables_per_scope; i++)
+  for (size_t i = window->count; i-- > 0;)
+    if (strcmp(window->params[i].name, name) == 0)
     {
-      VARIABLE *var = &scope->variables[i];
-      if (var->name != NULL && strcmp(var->name, name) == 0)
-      {
-        return var->value;
-      }
+      stats.variable_slots_scanned += window->count - i;
+      return &window->values[i];
     }
+  stats.variable_slots_scanned += window->count;
+  return NULL;
+}
 
-  assert(!"GetVariable: unknown variable.");
-  unreachable();
+// Takes over the reference held by `value`.
+static void SetVariable(INTERPRETER_STATE *state, char const *name, VALUE value)
+{
+  stats.variable_sets++;
+
+  // Only the body of a leaf runs while its window holds parameters, and it only assigns those.
+  LEAF_WINDOW *window = state->window;
+  if (window != NULL && window->count > 0)
+  {
+    VALUE *slot = FindInWindow(window, name);
+    assert(slot != NULL && "SetVariable: leaves only assign their parameters");
+    ReleaseValue(slot);
+    *slot = value;
+    return;
+  }
+
+  VARIABLE *var = FindVariable(state->current_scope, name);
+  if (var == NULL)
+    var = AddVariable(state, state->current_scope, name);
+  else
+    ReleaseValue(&var->value);
+  var->value = value;
+}
+
+static VALUE GetVariable(INTERPRETER_STATE *state, char const *name)
+{
+  stats.variable_gets++;
+
+  if (state->window != NULL)
+  {
+    VALUE *slot = FindInWindow(state->window, name);
+    if (slot != NULL)
+      return *slot;
+  }
+
+  for (SCOPE *scope = state->current_scope; scope != NULL; scope = scope->upper_scope)
+  {
+    VARIABLE *var = FindVariable(scope, name);
+    if (var != NULL)
+      return var->value;
+  }
+
+  RuntimeError(state, "Unknown variable '%s'.", name);
+}
+
+static SCOPE *GlobalScope(INTERPRETER_STATE *state)
+{
+  SCOPE *scope = state->current_scope;
+  while (scope->upper_scope != NULL)
+    scope = scope->upper_scope;
+  return scope;
+}
+
+void ForEachGlobal(INTERPRETER_STATE *state, void (*visit)(VARIABLE *var, void *context),
+                   void *context)
+{
+  SCOPE *globals = GlobalScope(state);
+  for (size_t i = 0; i < globals->capacity; i++)
+    if (globals->variables[i].name != NULL)
+      visit(&globals->variables[i], context);
+}
+
+void DefineGlobal(INTERPRETER_STATE *state, char const *name, VALUE value)
+{
+  SCOPE *globals = GlobalScope(state);
+  VARIABLE *var = FindVariable(globals, name);
+  if (var == NULL)
+    var = AddVariable(state, globals, name);
+  else
+    ReleaseValue(&var->value);
+  var->value = value;
+}
+
+VALUE const *FindGlobal(INTERPRETER_STATE *state, char const *name)
+{
+  VARIABLE *var = FindVariable(GlobalScope(state), name);
+  return var != NULL ? &var->value : NULL;
 }
 
 static VALUE EvaluateConstantNumber(INTERPRETER_STATE *state, AST_NODE *node)
@@ -102,114 +350,1500 @@ static VALUE EvaluateConstantNumber(INTERPRETER_STATE *state, AST_NODE *node)
   return ValueNumber(node->constant_number);
 }
 
+static bool OverMemoryLimit(INTERPRETER_STATE const *state)
+{
+  return state->scope_memory + state->lambda_memory + state->array_memory > state->memory_limit;
+}
+
+static void CheckMemoryLimit(INTERPRETER_STATE *state)
+{
+  if (OverMemoryLimit(state))
+    RuntimeError(state, "Memory limit of %zu bytes exceeded.", state->memory_limit);
+}
+
+void ChargeArrayMemory(INTERPRETER_STATE *state, size_t count)
+{
+  state->array_memory += ArraySize(count);
+  CheckMemoryLimit(state);
+}
+
+// Charges a new array to the evaluation's memory.
+static void CountArray(INTERPRETER_STATE *state, VALUE *value)
+{
+  state->array_memory += ArraySize(value->array->count);
+  if (OverMemoryLimit(state))
+  {
+    ReleaseValue(value);
+    CheckMemoryLimit(state);
+  }
+}
+
+static QUICKENED_OPERATION NumberForm(BINARY_OPERATION_KIND op)
+{
+  switch (op)
+  {
+    case BINOP_ADD:
+      return QUICK_ADD_NUMBERS;
+    case BINOP_SUB:
+      return QUICK_SUB_NUMBERS;
+    case BINOP_MUL:
+      return QUICK_MUL_NUMBERS;
+    case BINOP_DIV:
+      return QUICK_DIV_NUMBERS;
+  }
+
+  unreachable();
+}
+
+// Operations quicken into their number-only form the first time they see two numbers, which
+// then only has to check that the operands are still numbers. Once anything else turns up, the
+// operation falls back to the generic form for good.
 static VALUE EvaluateBinaryOperation(INTERPRETER_STATE *state, AST_NODE *node)
 {
   assert(node->kind == NODE_BINARY_OPERATION);
 
-  VALUE left = Evaluate(state, node->binary_operation.left);
-  VALUE right = Evaluate(state, node->binary_operation.right);
+  // The left operand is released if evaluating the right one fails.
+  HELD_VALUES held;
+  VALUE left = EvaluateNode(state, node->binary_operation.left);
+  HoldValues(state, &held, &left, 1);
+  VALUE right = EvaluateNode(state, node->binary_operation.right);
+  UnholdValues(state, &held);
+
+  QUICKENED_OPERATION quick =
+      atomic_load_explicit(&node->binary_operation.quick, memory_order_relaxed);
+  if (left.kind == VALUE_NUMBER && right.kind == VALUE_NUMBER)
+  {
+    switch (quick)
+    {
+      case QUICK_ADD_NUMBERS:
+        return ValueNumber(left.number + right.number);
+      case QUICK_SUB_NUMBERS:
+        return ValueNumber(left.number - right.number);
+      case QUICK_MUL_NUMBERS:
+        return ValueNumber(left.number * right.number);
+      case QUICK_DIV_NUMBERS:
+        return ValueNumber(left.number / right.number);
+      case QUICK_UNSEEN:
+        atomic_store_explicit(&node->binary_operation.quick,
+                              NumberForm(node->binary_operation.op), memory_order_relaxed);
+        break;
+      case QUICK_GENERIC:
+        break;
+    }
+  }
+  else if (quick != QUICK_GENERIC)
+  {
+    if (quick != QUICK_UNSEEN)
+      stats.arithmetic_deopts++;
+    atomic_store_explicit(&node->binary_operation.quick, QUICK_GENERIC, memory_order_relaxed);
+  }
+
+  char const *error = NULL;
+  if ((left.kind != VALUE_NUMBER && left.kind != VALUE_ARRAY) ||
+      (right.kind != VALUE_NUMBER && right.kind != VALUE_ARRAY))
+    error = "Arithmetic is only defined on numbers and arrays.";
+  else if (left.kind == VALUE_ARRAY && right.kind == VALUE_ARRAY &&
+           left.array->count != right.array->count)
+    error = "Arithmetic on arrays of different lengths.";
+
+  if (error != NULL)
+  {
+    ReleaseValue(&left);
+    ReleaseValue(&right);
+    RuntimeError(state, "%s", error);
+  }
 
+  VALUE result;
   switch (node->binary_operation.op)
   {
     case BINOP_ADD:
-      return ValueAdd(left, right);
+      result = ValueAdd(left, right);
+      break;
     case BINOP_SUB:
-      return ValueSub(left, right);
+      result = ValueSub(left, right);
+      break;
     case BINOP_MUL:
-      return ValueMul(left, right);
+      result = ValueMul(left, right);
+      break;
     case BINOP_DIV:
-      return ValueDiv(left, right);
-    case BINOP_SEQ:
-      return right;
+      result = ValueDiv(left, right);
+      break;
+    default:
+      unreachable();
   }
 
-  unreachable();
+  ReleaseValue(&left);
+  ReleaseValue(&right);
+  if (result.kind == VALUE_ARRAY)
+    CountArray(state, &result);
+  return result;
 }
 
 static VALUE EvaluateAssignment(INTERPRETER_STATE *state, AST_NODE *node)
 {
   assert(node->kind == NODE_ASSIGNMENT);
-  VALUE value = Evaluate(state, node->assignment.value);
-  SetVariable(state, node->assignment.var_name, value);
+  VALUE value = EvaluateNode(state, node->assignment.value);
+  SetVariable(state, node->assignment.var_name, RetainValue(value));
   return value;
 }
 
 static VALUE EvaluateVariable(INTERPRETER_STATE *state, AST_NODE *node)
 {
   assert(node->kind == NODE_VARIABLE);
-  return GetVariable(state, node->variable);
+  return RetainValue(GetVariable(state, node->variable));
 }
 
 static VALUE EvaluateLambda(INTERPRETER_STATE *state, AST_NODE *node)
 {
-  (void)state;
   assert(node->kind == NODE_LAMBDA);
-  return ValueLambda(node->lambda.params, node->lambda.body);
+
+  size_t ast_bytes = stats.bytes_allocated[STATS_MEMORY_AST];
+  VALUE lambda = ValueLambda(node->lambda.params, node->lambda.param_count, node->lambda.body);
+  state->lambda_memory += stats.bytes_allocated[STATS_MEMORY_AST] - ast_bytes;
+  if (OverMemoryLimit(state))
+  {
+    ReleaseValue(&lambda);
+    CheckMemoryLimit(state);
+  }
+
+  return lambda;
 }
 
-static VALUE EvaluateCall(INTERPRETER_STATE *state, AST_NODE *node)
+static char const *CallFrameName(AST_NODE *fn)
 {
-  assert(node->kind == NODE_CALL);
-  VALUE fn = Evaluate(state, node->call.fn);
-  assert(fn.kind == VALUE_LAMBDA && "EvaluateCall: only functions can be called");
+  return fn->kind == NODE_VARIABLE ? fn->variable : "<anonymous>";
+}
 
-  PushNewScope(state);
+static void PushCallFrame(INTERPRETER_STATE *state, char const *name)
+{
+  CALL_STACK *stack = &state->call_stack;
+  size_t depth = stack->depth;
+  if (depth < CALL_STACK_MAX_FRAMES)
+    stack->frames[depth] = name;
+  // The profiler's signal handler reads the frame after seeing the new depth.
+  atomic_signal_fence(memory_order_release);
+  stack->depth = depth + 1;
+}
+
+static void PopCallFrame(INTERPRETER_STATE *state)
+{
+  state->call_stack.depth--;
+}
+
+// A state for evaluating on a pool worker on behalf of `parent`. It only reads the scopes from
+// `scope` upwards; anything it pushes stays private to the child. Children are set up before their
+// task is submitted, as the parent carries on changing its own state meanwhile.
+static INTERPRETER_STATE ChildState(INTERPRETER_STATE *parent, SCOPE *scope, size_t fuel)
+{
+  return (INTERPRETER_STATE){
+      .current_scope = scope,
+      .window = NULL,
+      .frame = NULL,
+      .held = NULL,
+      .variables_per_scope = parent->variables_per_scope,
+      .call_stack = {.depth = 0},
+      .error_handler = NULL,
+      .error = "",
+      .pool = parent->pool,
+      .parallel_args_threshold = parent->parallel_args_threshold,
+      .optimize = parent->optimize,
+      .yield_countdown = YIELD_CHECK_INTERVAL,
+      .yield = NULL,
+      .yield_context = NULL,
+      .inline_args = NULL,
+      .fuel_limit = parent->fuel_limit,
+      .fuel = fuel,
+      .memory_limit = parent->memory_limit,
+      .scope_memory = parent->scope_memory,
+      .lambda_memory = parent->lambda_memory,
+      .array_memory = parent->array_memory,
+  };
+}
+
+typedef struct
+{
+  TASK task;
+  INTERPRETER_STATE child;
+  AST_NODE *node;
+  // Fuel available to the task when it starts, and what is left of it when it finishes.
+  size_t fuel;
+  size_t fuel_left;
+  VALUE value;
+  bool ok;
+  char error[INTERPRETER_ERROR_LEN];
+  // What the task counted, for the thread that waits for it to merge.
+  INTERPRETER_STATS stats;
+} ARGUMENT_TASK;
+
+static void RunArgumentTask(TASK *task)
+{
+  ARGUMENT_TASK *arg_task = (ARGUMENT_TASK *)task;
+
+  // Counters are thread-local, and the task may run on any thread, so it counts on its own.
+  INTERPRETER_STATS outer_stats = stats;
+  ResetStats();
+  arg_task->ok = TryEvaluate(&arg_task->child, arg_task->node, &arg_task->value);
+  arg_task->fuel_left = arg_task->child.fuel;
+  if (!arg_task->ok)
+    memcpy(arg_task->error, arg_task->child.error, sizeof(arg_task->error));
+  arg_task->stats = stats;
+  stats = outer_stats;
+}
+
+static void ReleaseArgumentValues(ARGUMENT_TASK *tasks, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    if (tasks[i].ok)
+      ReleaseValue(&tasks[i].value);
+}
+
+// Evaluates the arguments of a call marked by AnalyzeParallelCalls and binds them to `params` in
+// the callee's scope, which has just been pushed and is still empty.
+static void BindParallelArguments(INTERPRETER_STATE *state, AST_NODE *node, FN_PARAM *params)
+{
+  FN_ARG *args = node->call.args;
+  size_t count = node->call.arg_count;
+  ARGUMENT_TASK *tasks = malloc(sizeof(*tasks) * count);
 
-  FN_PARAM *current_param = fn.lambda.params;
-  FN_ARG *current_arg = node->call.args;
+  // The last expensive argument is evaluated on this thread rather than handed to the pool.
+  size_t inline_spawn = count;
+  for (size_t i = 0; i < count; i++)
+    if (args[i].spawn)
+      inline_spawn = i;
 
-  while (true)
+  for (size_t i = 0; i < count; i++)
   {
-    if (current_param == NULL && current_arg == NULL)
-      break;
+    tasks[i] = (ARGUMENT_TASK){
+        .task = {.run = RunArgumentTask},
+        .node = args[i].value,
+        .fuel = state->fuel,
+    };
+    if (args[i].spawn && i != inline_spawn)
+    {
+      tasks[i].child = ChildState(state, state->current_scope, state->fuel);
+      SubmitTask(state->pool, &tasks[i].task);
+    }
+  }
 
-    if ((current_param == NULL && current_arg != NULL) ||
-        (current_param != NULL && current_arg == NULL))
+  for (size_t i = 0; i < count; i++)
+    if (!args[i].spawn || i == inline_spawn)
     {
-      assert(!"EvaluateCall: number of arguments does not match number of function parameters");
+      tasks[i].ok = TryEvaluate(state, args[i].value, &tasks[i].value);
+      if (!tasks[i].ok)
+        memcpy(tasks[i].error, state->error, sizeof(tasks[i].error));
     }
 
-    SetVariable(state, current_param->name, Evaluate(state, current_arg->value));
+  // Every task has to finish before this frame can be left, even if an argument failed. The fuel
+  // the tasks burned is charged to this state afterwards.
+  size_t fuel_spent = 0;
+  for (size_t i = 0; i < count; i++)
+    if (args[i].spawn && i != inline_spawn)
+    {
+      WaitForTask(state->pool, &tasks[i].task);
+      fuel_spent += tasks[i].fuel - tasks[i].fuel_left;
+      MergeStats(&stats, &tasks[i].stats);
+    }
+
+  for (size_t i = 0; i < count; i++)
+    if (!tasks[i].ok)
+    {
+      char error[INTERPRETER_ERROR_LEN];
+      memcpy(error, tasks[i].error, sizeof(error));
+      ReleaseArgumentValues(tasks, count);
+      free(tasks);
+      RuntimeError(state, "%s", error);
+    }
 
-    current_param = current_param->next;
-    current_arg = current_arg->next;
+  if (fuel_spent > state->fuel)
+  {
+    ReleaseArgumentValues(tasks, count);
+    free(tasks);
+    state->fuel = 0;
+    RuntimeError(state, "Out of fuel.");
   }
+  state->fuel -= fuel_spent;
+
+  for (size_t i = 0; i < count; i++)
+    SetVariable(state, params[i].name, tasks[i].value);
+
+  free(tasks);
+}
+
+static void CheckYield(INTERPRETER_STATE *state)
+{
+  if (--state->yield_countdown != 0)
+    return;
+
+  state->yield_countdown = YIELD_CHECK_INTERVAL;
+  if (state->yield != NULL)
+    state->yield(state);
+}
+
+// Calls are the only way to loop in tan, so they are where long evaluations give up control and
+// where fuel is spent.
+static void SpendFuel(INTERPRETER_STATE *state)
+{
+  CheckYield(state);
+  if (state->fuel == 0)
+    RuntimeError(state, "Out of fuel.");
+  state->fuel--;
+}
 
-  VALUE fn_ret = Evaluate(state, fn.lambda.body);
+static VALUE CallBuiltin(INTERPRETER_STATE *state, BUILTIN const *builtin, VALUE *args)
+{
+  stats.builtin_calls++;
+  PushCallFrame(state, builtin->name);
+  TRACE_BEGIN(builtin->name);
+  VALUE result = builtin->call(state, args, builtin->data);
+  TRACE_END(builtin->name);
+  PopCallFrame(state);
+  return result;
+}
+
+// Evaluates the body of `lambda`, whose parameters have been bound in a new scope, and pops that
+// scope again.
+static VALUE CallLambdaBody(INTERPRETER_STATE *state, LAMBDA *lambda, char const *name)
+{
+  PushCallFrame(state, name);
+  TRACE_BEGIN(name);
+  VALUE result = EvaluateNode(state, LambdaCode(state, lambda));
+  TRACE_END(name);
   PopScope(state);
-  return fn_ret;
+  PopCallFrame(state);
+  return result;
 }
 
-static VALUE EvaluateIfElse(INTERPRETER_STATE *state, AST_NODE *node)
+static _Noreturn void ArgumentCountError(INTERPRETER_STATE *state, VALUE *fn)
 {
-  assert(node->kind == NODE_IF_ELSE);
-  VALUE condition = Evaluate(state, node->if_else.condition);
-  if (condition.kind != VALUE_NUMBER || condition.number != 0.0)
-    return Evaluate(state, node->if_else.if_true);
-  else
-    return Evaluate(state, node->if_else.if_false);
+  ReleaseValue(fn);
+  RuntimeError(state, "Number of arguments does not match number of function parameters.");
 }
 
-VALUE Evaluate(INTERPRETER_STATE *state, AST_NODE *node)
+// Unlike lambdas, builtins take their arguments from an array on the C stack, so calling one
+// neither pushes a scope nor binds any variables.
+static VALUE EvaluateBuiltinCall(INTERPRETER_STATE *state, AST_NODE *node, BUILTIN const *builtin)
+{
+  VALUE args[BUILTIN_MAX_PARAMS];
+  HELD_VALUES held;
+  HoldValues(state, &held, args, 0);
+  for (size_t i = 0; i < node->call.arg_count; i++)
+  {
+    args[i] = EvaluateNode(state, node->call.args[i].value);
+    held.count++;
+  }
+
+  VALUE result = CallBuiltin(state, builtin, args);
+  UnholdValues(state, &held);
+
+  for (size_t i = 0; i < node->call.arg_count; i++)
+    ReleaseValue(&args[i]);
+  return result;
+}
+
+// ---------------
+// Inlining
+// ---------------
+
+// Calls to small global lambdas evaluate the lambda's body in the caller's scope instead of binding
+// the arguments in a scope of their own. Bodies are limited to expressions that cannot tell the
+// difference: they neither assign, which would write to the caller's scope, nor call, as the
+// callee could read the parameters through the scope chain. Inlined calls still spend fuel but do
+// not show up in profiles or traces.
+#define INLINE_MAX_NODES 24
+#define INLINE_MAX_PARAMS 8
+
+// Adds the size of `node` to `*size`, or returns false if it cannot be inlined.
+static bool InlinableBody(AST_NODE *node, size_t *size)
 {
+  if (++*size > INLINE_MAX_NODES)
+    return false;
+
   switch (node->kind)
   {
     case NODE_CONSTANT_NUMBER:
-      return EvaluateConstantNumber(state, node);
+    case NODE_VARIABLE:
+    case NODE_LAMBDA:
+      return true;
     case NODE_BINARY_OPERATION:
-      return EvaluateBinaryOperation(state, node);
+      return InlinableBody(node->binary_operation.left, size) &&
+             InlinableBody(node->binary_operation.right, size);
     case NODE_ASSIGNMENT:
-      return EvaluateAssignment(state, node);
-    case NODE_VARIABLE:
-      return EvaluateVariable(state, node);
+    case NODE_CALL:
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      return false;
+    case NODE_IF_ELSE:
+      return InlinableBody(node->if_else.condition, size) &&
+             InlinableBody(node->if_else.if_true, size) &&
+             InlinableBody(node->if_else.if_false, size);
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        if (!InlinableBody(node->sequence.items[i], size))
+          return false;
+      return true;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        if (!InlinableBody(node->array.items[i], size))
+          return false;
+      return true;
+    case NODE_INDEX:
+      return InlinableBody(node->index.array, size) && InlinableBody(node->index.index, size);
+  }
+
+  unreachable();
+}
+
+// Whether evaluating `node` could see the first `count` parameters bound in the callee's scope, as
+// serially evaluated arguments do: it reads one of them, or makes a call whose callee could.
+static bool SeesParameters(AST_NODE *node, FN_PARAM *params, size_t count)
+{
+  if (count == 0)
+    return false;
+
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
     case NODE_LAMBDA:
-      return EvaluateLambda(state, node);
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_LOAD_TEMPORARY:
+      return false;
+    case NODE_VARIABLE:
+      for (size_t i = 0; i < count; i++)
+        if (strcmp(node->variable, params[i].name) == 0)
+          return true;
+      return false;
     case NODE_CALL:
-      return EvaluateCall(state, node);
+      return true;
+    case NODE_BINARY_OPERATION:
+      return SeesParameters(node->binary_operation.left, params, count) ||
+             SeesParameters(node->binary_operation.right, params, count);
+    case NODE_ASSIGNMENT:
+      return SeesParameters(node->assignment.value, params, count);
     case NODE_IF_ELSE:
-      return EvaluateIfElse(state, node);
+      return SeesParameters(node->if_else.condition, params, count) ||
+             SeesParameters(node->if_else.if_true, params, count) ||
+             SeesParameters(node->if_else.if_false, params, count);
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        if (SeesParameters(node->sequence.items[i], params, count))
+          return true;
+      return false;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        if (SeesParameters(node->array.items[i], params, count))
+          return true;
+      return false;
+    case NODE_INDEX:
+      return SeesParameters(node->index.array, params, count) ||
+             SeesParameters(node->index.index, params, count);
+    case NODE_FRAME:
+      return SeesParameters(node->frame.body, params, count);
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      return SeesParameters(node->temporary.value, params, count);
+  }
+
+  unreachable();
+}
+
+// Copies an inlinable body with the variables naming a parameter replaced by NODE_PARAMETER nodes.
+// A name that appears twice refers to the later parameter, as when the arguments are bound in
+// order. Lambdas are copied as they are, since their bodies see the scope of their own calls.
+static AST_NODE *SubstituteParameters(AST_NODE *node, FN_PARAM *params, size_t count)
+{
+  AST_NODE *copy;
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_LAMBDA:
+      return CopyAST(node);
+    case NODE_VARIABLE:
+      for (size_t i = count; i-- > 0;)
+        if (strcmp(node->variable, params[i].name) == 0)
+        {
+          copy = NewASTNode(NODE_PARAMETER);
+          copy->parameter = i;
+          return copy;
+        }
+      return CopyAST(node);
+    case NODE_BINARY_OPERATION:
+      copy = NewASTNode(node->kind);
+      copy->binary_operation.left =
+          SubstituteParameters(node->binary_operation.left, params, count);
+      copy->binary_operation.right =
+          SubstituteParameters(node->binary_operation.right, params, count);
+      copy->binary_operation.op = node->binary_operation.op;
+      atomic_init(&copy->binary_operation.quick, QUICK_UNSEEN);
+      return copy;
+    case NODE_IF_ELSE:
+      copy = NewASTNode(node->kind);
+      copy->if_else.condition = SubstituteParameters(node->if_else.condition, params, count);
+      copy->if_else.if_true = SubstituteParameters(node->if_else.if_true, params, count);
+      copy->if_else.if_false = SubstituteParameters(node->if_else.if_false, params, count);
+      return copy;
+    case NODE_SEQUENCE:
+      copy = NewASTNode(node->kind);
+      copy->sequence.count = node->sequence.count;
+      copy->sequence.items = AllocAST(sizeof(AST_NODE *) * node->sequence.count);
+      for (size_t i = 0; i < node->sequence.count; i++)
+        copy->sequence.items[i] = SubstituteParameters(node->sequence.items[i], params, count);
+      return copy;
+    case NODE_ARRAY:
+      copy = NewASTNode(node->kind);
+      copy->array.count = node->array.count;
+      copy->array.items = AllocAST(sizeof(AST_NODE *) * node->array.count);
+      for (size_t i = 0; i < node->array.count; i++)
+        copy->array.items[i] = SubstituteParameters(node->array.items[i], params, count);
+      return copy;
+    case NODE_INDEX:
+      copy = NewASTNode(node->kind);
+      copy->index.array = SubstituteParameters(node->index.array, params, count);
+      copy->index.index = SubstituteParameters(node->index.index, params, count);
+      return copy;
+    case NODE_ASSIGNMENT:
+    case NODE_CALL:
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      break;
   }
 
-  assert(!"EvaluateProgram: unreachable");
+  assert(!"SubstituteParameters: body cannot be inlined");
   unreachable();
 }
+
+// Whether the arguments of `node` can be evaluated in the caller's scope before any parameter of
+// `lambda` is bound, with the same result as evaluating them in order in the callee's scope.
+static bool IndependentArguments(AST_NODE *node, LAMBDA *lambda)
+{
+  for (size_t i = 0; i < node->call.arg_count; i++)
+    if (HasAssignment(node->call.args[i].value, false) ||
+        SeesParameters(node->call.args[i].value, lambda->params, i))
+      return false;
+  return true;
+}
+
+// Returns NULL if the body of `lambda` has not been parsed yet.
+static AST_NODE *ParsedBody(LAMBDA *lambda)
+{
+  AST_NODE *body = lambda->body;
+  if (body->kind == NODE_LAZY)
+    return atomic_load_explicit(&body->lazy.body, memory_order_acquire);
+  return body;
+}
+
+static bool IsInlinable(INTERPRETER_STATE *state, AST_NODE *node, LAMBDA *lambda, AST_NODE *body)
+{
+  // Lambdas passed around as values are left alone.
+  AST_NODE *fn = node->call.fn;
+  if (fn->kind != NODE_VARIABLE)
+    return false;
+  VALUE const *global = FindGlobal(state, fn->variable);
+  if (global == NULL || global->kind != VALUE_LAMBDA || global->lambda != lambda)
+    return false;
+
+  size_t size = 0;
+  return lambda->param_count <= INLINE_MAX_PARAMS && InlinableBody(body, &size);
+}
+
+// Sets up `node`, a call to `lambda`, and records that in the call. Returns the record the call
+// ends up with, which is another thread's if it got there first, or NULL if the body of the lambda
+// has not been parsed yet.
+static CALL_SITE *NewCallSite(INTERPRETER_STATE *state, AST_NODE *node, LAMBDA *lambda)
+{
+  AST_NODE *body = ParsedBody(lambda);
+  if (body == NULL)
+    return NULL;
+
+  CALL_SITE *site = malloc(sizeof(*site));
+  *site = (CALL_SITE){
+      .lambda_id = lambda->id,
+      .independent_args = IndependentArguments(node, lambda),
+      .inlined_body = NULL,
+  };
+  // Inlined arguments are evaluated in the caller's scope rather than in the callee's.
+  if (site->independent_args && IsInlinable(state, node, lambda, body))
+    site->inlined_body = SubstituteParameters(body, lambda->params, lambda->param_count);
+
+  CALL_SITE *expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&node->call.site, &expected, site,
+                                               memory_order_acq_rel, memory_order_acquire))
+  {
+    if (site->inlined_body != NULL)
+      FreeAST(site->inlined_body);
+    free(site);
+    return expected;
+  }
+  return site;
+}
+
+// Evaluates each argument of `node` once, in order, and then the inlined `body` with its
+// NODE_PARAMETER nodes reading the arguments.
+static VALUE EvaluateInlinedCall(INTERPRETER_STATE *state, AST_NODE *node, AST_NODE *body)
+{
+  stats.calls_inlined++;
+
+  VALUE args[INLINE_MAX_PARAMS];
+  HELD_VALUES held;
+  HoldValues(state, &held, args, 0);
+  for (size_t i = 0; i < node->call.arg_count; i++)
+  {
+    args[i] = EvaluateNode(state, node->call.args[i].value);
+    held.count++;
+  }
+
+  VALUE const *outer_args = state->inline_args;
+  state->inline_args = args;
+  VALUE result = EvaluateNode(state, body);
+  state->inline_args = outer_args;
+  UnholdValues(state, &held);
+
+  for (size_t i = 0; i < node->call.arg_count; i++)
+    ReleaseValue(&args[i]);
+  return result;
+}
+
+static VALUE EvaluateParameter(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_PARAMETER);
+  return RetainValue(state->inline_args[node->parameter]);
+}
+
+// ---------------
+// Leaf calls
+// ---------------
+
+// Leaf lambdas make no calls, create no lambdas and assign nothing but their parameters, so only
+// their own body can see the parameters. Calls to them keep the parameters in a LEAF_WINDOW on the
+// native stack instead of allocating a scope.
+
+static bool IsLeafBody(AST_NODE *node, FN_PARAM *params, size_t count)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_VARIABLE:
+      return true;
+    case NODE_LAMBDA:
+    case NODE_CALL:
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      return false;
+    case NODE_BINARY_OPERATION:
+      return IsLeafBody(node->binary_operation.left, params, count) &&
+             IsLeafBody(node->binary_operation.right, params, count);
+    case NODE_ASSIGNMENT:
+      for (size_t i = 0; i < count; i++)
+        if (strcmp(node->assignment.var_name, params[i].name) == 0)
+          return IsLeafBody(node->assignment.value, params, count);
+      return false;
+    case NODE_IF_ELSE:
+      return IsLeafBody(node->if_else.condition, params, count) &&
+             IsLeafBody(node->if_else.if_true, params, count) &&
+             IsLeafBody(node->if_else.if_false, params, count);
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        if (!IsLeafBody(node->sequence.items[i], params, count))
+          return false;
+      return true;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        if (!IsLeafBody(node->array.items[i], params, count))
+          return false;
+      return true;
+    case NODE_INDEX:
+      return IsLeafBody(node->index.array, params, count) &&
+             IsLeafBody(node->index.index, params, count);
+  }
+
+  unreachable();
+}
+
+static bool IsLeafLambda(LAMBDA *lambda)
+{
+  LEAF_KIND leaf = atomic_load_explicit(&lambda->leaf, memory_order_relaxed);
+  if (leaf == LEAF_UNKNOWN)
+  {
+    // Bodies that have not been parsed yet are looked at again on a later call.
+    AST_NODE *body = ParsedBody(lambda);
+    if (body == NULL)
+      return false;
+
+    leaf = lambda->param_count <= LEAF_WINDOW_SIZE &&
+                   IsLeafBody(body, lambda->params, lambda->param_count)
+               ? LEAF_YES
+               : LEAF_NO;
+    atomic_store_explicit(&lambda->leaf, leaf, memory_order_relaxed);
+  }
+  return leaf == LEAF_YES;
+}
+
+// Takes over the reference held by `callee`. Parameters are added to the window one by one.
+static void PushWindow(INTERPRETER_STATE *state, LEAF_WINDOW *window, LAMBDA *lambda,
+                       VALUE callee)
+{
+  *window = (LEAF_WINDOW){
+      .outer = state->window,
+      .params = lambda->params,
+      .count = 0,
+      .callee = callee,
+  };
+  state->window = window;
+}
+
+static void PopWindow(INTERPRETER_STATE *state)
+{
+  LEAF_WINDOW *window = state->window;
+  state->window = window->outer;
+  for (size_t i = 0; i < window->count; i++)
+    ReleaseValue(&window->values[i]);
+  ReleaseValue(&window->callee);
+}
+
+// Like CallLambdaBody, for a leaf whose parameters have been bound in a new window.
+static VALUE CallLeafBody(INTERPRETER_STATE *state, LAMBDA *lambda, char const *name)
+{
+  stats.leaf_calls++;
+  PushCallFrame(state, name);
+  TRACE_BEGIN(name);
+  VALUE result = EvaluateNode(state, LambdaCode(state, lambda));
+  TRACE_END(name);
+  PopWindow(state);
+  PopCallFrame(state);
+  return result;
+}
+
+// ---------------
+// Optimized bodies
+// ---------------
+
+// With `optimize` set, calls evaluate lambda bodies as rewritten by OptimizeBody, which the first
+// call to find the body parsed works out.
+static AST_NODE *LambdaCode(INTERPRETER_STATE *state, LAMBDA *lambda)
+{
+  AST_NODE *code = atomic_load_explicit(&lambda->code, memory_order_acquire);
+  if (code != NULL)
+    return code;
+  if (!state->optimize)
+    return lambda->body;
+
+  AST_NODE *body = ParsedBody(lambda);
+  if (body == NULL)
+    return lambda->body;
+  code = OptimizeBody(body, lambda->params, lambda->param_count);
+  if (code == NULL)
+    code = lambda->body;
+
+  AST_NODE *expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&lambda->code, &expected, code,
+                                               memory_order_acq_rel, memory_order_acquire))
+  {
+    if (code != lambda->body)
+      FreeAST(code);
+    return expected;
+  }
+  return code;
+}
+
+static void PopFrame(INTERPRETER_STATE *state)
+{
+  TEMPORARY_FRAME *frame = state->frame;
+  state->frame = frame->outer;
+  for (size_t i = 0; i < frame->count; i++)
+    if (frame->filled[i])
+      ReleaseValue(&frame->values[i]);
+}
+
+static VALUE EvaluateFrame(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_FRAME);
+
+  TEMPORARY_FRAME frame;
+  frame.outer = state->frame;
+  frame.code = node;
+  frame.scope = state->current_scope;
+  frame.count = node->frame.slot_count;
+  // A call the body makes to itself straight from its own scope sees the same variables as the
+  // body does, except for the ones the body binds, which invariants do not read.
+  frame.inherits = frame.outer != NULL && frame.outer->code == node &&
+                   frame.scope->upper_scope == frame.outer->scope;
+  for (size_t i = 0; i < frame.count; i++)
+    frame.filled[i] = false;
+
+  state->frame = &frame;
+  VALUE result = EvaluateNode(state, node->frame.body);
+  PopFrame(state);
+  return result;
+}
+
+static VALUE EvaluateStoreTemporary(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_STORE_TEMPORARY);
+  VALUE value = EvaluateNode(state, node->temporary.value);
+  TEMPORARY_FRAME *frame = state->frame;
+  // Values sharing a slot are equal, and an invariant may have filled it already.
+  if (frame->filled[node->temporary.slot])
+    ReleaseValue(&frame->values[node->temporary.slot]);
+  frame->values[node->temporary.slot] = RetainValue(value);
+  frame->filled[node->temporary.slot] = true;
+  return value;
+}
+
+static VALUE EvaluateLoadTemporary(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_LOAD_TEMPORARY);
+  assert(state->frame->filled[node->temporary.slot]);
+  if (node->temporary.call)
+    stats.calls_reused++;
+  else
+    stats.expressions_reused++;
+  return RetainValue(state->frame->values[node->temporary.slot]);
+}
+
+static VALUE EvaluateInvariant(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_INVARIANT);
+  TEMPORARY_FRAME *frame = state->frame;
+  size_t slot = node->temporary.slot;
+  if (frame->filled[slot])
+  {
+    stats.invariants_hoisted++;
+    return RetainValue(frame->values[slot]);
+  }
+
+  TEMPORARY_FRAME *outer = frame->outer;
+  VALUE value;
+  if (frame->inherits && outer->filled[slot])
+  {
+    stats.invariants_hoisted++;
+    value = RetainValue(outer->values[slot]);
+  }
+  else
+    value = EvaluateNode(state, node->temporary.value);
+  frame->values[slot] = value;
+  frame->filled[slot] = true;
+  return RetainValue(value);
+}
+
+static VALUE EvaluateCall(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_CALL);
+  SpendFuel(state);
+
+  VALUE fn = EvaluateNode(state, node->call.fn);
+  if (fn.kind == VALUE_BUILTIN)
+  {
+    if (node->call.arg_count != fn.builtin->param_count)
+      ArgumentCountError(state, &fn);
+    return EvaluateBuiltinCall(state, node, fn.builtin);
+  }
+
+  if (fn.kind != VALUE_LAMBDA)
+  {
+    ReleaseValue(&fn);
+    RuntimeError(state, "Only functions can be called.");
+  }
+
+  LAMBDA *lambda = fn.lambda;
+  if (node->call.arg_count != lambda->param_count)
+    ArgumentCountError(state, &fn);
+
+  bool parallel = node->call.parallel && state->pool != NULL;
+  if (!parallel)
+  {
+    CALL_SITE *site = atomic_load_explicit(&node->call.site, memory_order_acquire);
+    if (site == NULL)
+      site = NewCallSite(state, node, lambda);
+    // Once the variable is reassigned, the call no longer reaches the lambda it was set up for.
+    bool same_lambda = site != NULL && site->lambda_id == lambda->id;
+    if (same_lambda && site->inlined_body != NULL)
+    {
+      ReleaseValue(&fn);
+      return EvaluateInlinedCall(state, node, site->inlined_body);
+    }
+
+    if (IsLeafLambda(lambda) &&
+        (same_lambda ? site->independent_args : IndependentArguments(node, lambda)))
+    {
+      // The arguments cannot see the parameters bound before them, so the window being filled in
+      // does not change what they evaluate to.
+      LEAF_WINDOW window;
+      PushWindow(state, &window, lambda, fn);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+      {
+        VALUE arg = EvaluateNode(state, node->call.args[i].value);
+        window.values[window.count++] = arg;
+      }
+      return CallLeafBody(state, lambda, CallFrameName(node->call.fn));
+    }
+  }
+
+  PushNewScope(state);
+  state->current_scope->callee = fn;
+  CheckMemoryLimit(state);
+
+  if (parallel)
+    BindParallelArguments(state, node, lambda->params);
+  else
+    for (size_t i = 0; i < node->call.arg_count; i++)
+      SetVariable(state, lambda->params[i].name, EvaluateNode(state, node->call.args[i].value));
+
+  return CallLambdaBody(state, lambda, CallFrameName(node->call.fn));
+}
+
+VALUE CallFunction(INTERPRETER_STATE *state, VALUE fn, VALUE *args, size_t arg_count)
+{
+  // The arguments are released if the call fails before they have been bound.
+  HELD_VALUES held;
+  HoldValues(state, &held, args, arg_count);
+  SpendFuel(state);
+
+  if (fn.kind == VALUE_BUILTIN)
+  {
+    if (arg_count != fn.builtin->param_count)
+      RuntimeError(state, "Number of arguments does not match number of function parameters.");
+
+    VALUE result = CallBuiltin(state, fn.builtin, args);
+    UnholdValues(state, &held);
+    for (size_t i = 0; i < arg_count; i++)
+      ReleaseValue(&args[i]);
+    return result;
+  }
+
+  if (fn.kind != VALUE_LAMBDA)
+    RuntimeError(state, "Only functions can be called.");
+  if (arg_count != fn.lambda->param_count)
+    RuntimeError(state, "Number of arguments does not match number of function parameters.");
+
+  if (IsLeafLambda(fn.lambda))
+  {
+    // The caller keeps `fn` alive.
+    LEAF_WINDOW window;
+    UnholdValues(state, &held);
+    PushWindow(state, &window, fn.lambda, ValueNumber(0));
+    for (size_t i = 0; i < arg_count; i++)
+      window.values[window.count++] = args[i];
+    return CallLeafBody(state, fn.lambda, "<anonymous>");
+  }
+
+  PushNewScope(state);
+  CheckMemoryLimit(state);
+  UnholdValues(state, &held);
+  for (size_t i = 0; i < arg_count; i++)
+    SetVariable(state, fn.lambda->params[i].name, args[i]);
+
+  return CallLambdaBody(state, fn.lambda, "<anonymous>");
+}
+
+typedef struct
+{
+  TASK task;
+  INTERPRETER_STATE child;
+  CHUNK_FN *run;
+  void *context;
+  size_t begin;
+  size_t end;
+  size_t fuel;
+  size_t fuel_left;
+  bool ok;
+  char error[INTERPRETER_ERROR_LEN];
+  INTERPRETER_STATS stats;
+} CHUNK_TASK;
+
+// Like TryEvaluate, for a chunk run on `state`.
+static bool TryRunChunk(INTERPRETER_STATE *state, CHUNK_TASK *chunk)
+{
+  ERROR_HANDLER handler = {
+      .window = state->window,
+      .frame = state->frame,
+      .held = state->held,
+      .call_depth = state->call_stack.depth,
+  };
+  ERROR_HANDLER *outer_handler = state->error_handler;
+  SCOPE *entry_scope = state->current_scope;
+
+  bool ok = true;
+  state->error_handler = &handler;
+  if (setjmp(handler.jump) == 0)
+    chunk->run(state, chunk->begin, chunk->end, chunk->context);
+  else
+  {
+    while (state->current_scope != entry_scope)
+      PopScope(state);
+    memcpy(chunk->error, state->error, sizeof(chunk->error));
+    ok = false;
+  }
+  state->error_handler = outer_handler;
+
+  return ok;
+}
+
+static void RunChunkTask(TASK *task)
+{
+  CHUNK_TASK *chunk = (CHUNK_TASK *)task;
+
+  // Counted on its own like an argument task.
+  INTERPRETER_STATS outer_stats = stats;
+  ResetStats();
+  chunk->ok = TryRunChunk(&chunk->child, chunk);
+  chunk->fuel_left = chunk->child.fuel;
+  chunk->stats = stats;
+  stats = outer_stats;
+}
+
+void RunChunks(INTERPRETER_STATE *state, size_t count, size_t chunk_size, CHUNK_FN *run,
+               void *context)
+{
+  size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+  if (state->pool == NULL || chunk_count < 2)
+  {
+    for (size_t begin = 0; begin < count; begin += chunk_size)
+      run(state, begin, begin + chunk_size < count ? begin + chunk_size : count, context);
+    return;
+  }
+
+  CHUNK_TASK *chunks = malloc(sizeof(*chunks) * chunk_count);
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    size_t begin = i * chunk_size;
+    chunks[i] = (CHUNK_TASK){
+        .task = {.run = RunChunkTask},
+        .run = run,
+        .context = context,
+        .begin = begin,
+        .end = begin + chunk_size < count ? begin + chunk_size : count,
+        .fuel = state->fuel,
+    };
+    // The first chunk is run on this thread.
+    if (i > 0)
+    {
+      chunks[i].child = ChildState(state, state->current_scope, state->fuel);
+      SubmitTask(state->pool, &chunks[i].task);
+    }
+  }
+
+  chunks[0].ok = TryRunChunk(state, &chunks[0]);
+
+  // As in BindParallelArguments, every chunk has to finish before an error can be raised, and the
+  // fuel burned on the pool is charged afterwards.
+  size_t fuel_spent = 0;
+  for (size_t i = 1; i < chunk_count; i++)
+  {
+    WaitForTask(state->pool, &chunks[i].task);
+    fuel_spent += chunks[i].fuel - chunks[i].fuel_left;
+    MergeStats(&stats, &chunks[i].stats);
+  }
+
+  for (size_t i = 0; i < chunk_count; i++)
+    if (!chunks[i].ok)
+    {
+      char error[INTERPRETER_ERROR_LEN];
+      memcpy(error, chunks[i].error, sizeof(error));
+      free(chunks);
+      RuntimeError(state, "%s", error);
+    }
+  free(chunks);
+
+  if (fuel_spent > state->fuel)
+  {
+    state->fuel = 0;
+    RuntimeError(state, "Out of fuel.");
+  }
+  state->fuel -= fuel_spent;
+}
+
+static VALUE EvaluateIfElse(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_IF_ELSE);
+  VALUE condition = EvaluateNode(state, node->if_else.condition);
+  ReleaseValue(&condition);
+  if (condition.kind != VALUE_NUMBER || condition.number != 0.0)
+    return EvaluateNode(state, node->if_else.if_true);
+  else
+    return EvaluateNode(state, node->if_else.if_false);
+}
+
+static VALUE EvaluateSequence(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_SEQUENCE);
+  for (size_t i = 0; i + 1 < node->sequence.count; i++)
+  {
+    VALUE value = EvaluateNode(state, node->sequence.items[i]);
+    ReleaseValue(&value);
+  }
+  return EvaluateNode(state, node->sequence.items[node->sequence.count - 1]);
+}
+
+static VALUE EvaluateLazy(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_LAZY);
+
+  AST_NODE *body = atomic_load_explicit(&node->lazy.body, memory_order_acquire);
+  if (body == NULL)
+  {
+    body = ParseProgram(node->lazy.source);
+    if (body == NULL)
+      RuntimeError(state, "Syntax error in function body.");
+    if (state->parallel_args_threshold > 0)
+      AnalyzeParallelCalls(body, state->parallel_args_threshold);
+
+    // Calls on other threads may have parsed the same body meanwhile; the first one is kept.
+    AST_NODE *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&node->lazy.body, &expected, body,
+                                                 memory_order_acq_rel, memory_order_acquire))
+    {
+      FreeAST(body);
+      body = expected;
+    }
+  }
+
+  return EvaluateNode(state, body);
+}
+
+static VALUE EvaluateArray(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_ARRAY);
+
+  VALUE array = ValueArray(NewArray(node->array.count));
+  CountArray(state, &array);
+
+  // The partly filled array is released if evaluating an item fails.
+  HELD_VALUES held;
+  HoldValues(state, &held, &array, 1);
+  for (size_t i = 0; i < node->array.count; i++)
+  {
+    VALUE item = EvaluateNode(state, node->array.items[i]);
+    if (item.kind != VALUE_NUMBER)
+    {
+      UnholdValues(state, &held);
+      ReleaseValue(&item);
+      ReleaseValue(&array);
+      RuntimeError(state, "Arrays can only hold numbers.");
+    }
+    array.array->items[i] = item.number;
+  }
+  UnholdValues(state, &held);
+
+  return array;
+}
+
+static VALUE EvaluateIndex(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  assert(node->kind == NODE_INDEX);
+
+  // The array is released if evaluating the index fails.
+  HELD_VALUES held;
+  VALUE array = EvaluateNode(state, node->index.array);
+  HoldValues(state, &held, &array, 1);
+  VALUE index = EvaluateNode(state, node->index.index);
+  UnholdValues(state, &held);
+
+  char const *error = NULL;
+  if (array.kind != VALUE_ARRAY)
+    error = "Only arrays can be indexed.";
+  else if (index.kind != VALUE_NUMBER ||
+           !(index.number >= 0.0 && index.number < (double)array.array->count) ||
+           index.number != (double)(size_t)index.number)
+    error = "Array index out of range.";
+
+  ReleaseValue(&index);
+  if (error != NULL)
+  {
+    ReleaseValue(&array);
+    RuntimeError(state, "%s", error);
+  }
+
+  VALUE item = ValueNumber(array.array->items[(size_t)index.number]);
+  ReleaseValue(&array);
+  return item;
+}
+
+static VALUE EvaluateNode(INTERPRETER_STATE *state, AST_NODE *node)
+{
+  stats.evaluations[node->kind]++;
+
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      return EvaluateConstantNumber(state, node);
+    case NODE_BINARY_OPERATION:
+      return EvaluateBinaryOperation(state, node);
+    case NODE_ASSIGNMENT:
+      return EvaluateAssignment(state, node);
+    case NODE_VARIABLE:
+      return EvaluateVariable(state, node);
+    case NODE_LAMBDA:
+      return EvaluateLambda(state, node);
+    case NODE_CALL:
+      return EvaluateCall(state, node);
+    case NODE_IF_ELSE:
+      return EvaluateIfElse(state, node);
+    case NODE_SEQUENCE:
+      return EvaluateSequence(state, node);
+    case NODE_LAZY:
+      return EvaluateLazy(state, node);
+    case NODE_ARRAY:
+      return EvaluateArray(state, node);
+    case NODE_INDEX:
+      return EvaluateIndex(state, node);
+    case NODE_PARAMETER:
+      return EvaluateParameter(state, node);
+    case NODE_FRAME:
+      return EvaluateFrame(state, node);
+    case NODE_STORE_TEMPORARY:
+      return EvaluateStoreTemporary(state, node);
+    case NODE_LOAD_TEMPORARY:
+      return EvaluateLoadTemporary(state, node);
+    case NODE_INVARIANT:
+      return EvaluateInvariant(state, node);
+  }
+
+  assert(!"EvaluateNode: unreachable");
+  unreachable();
+}
+
+static bool TryEvaluate(INTERPRETER_STATE *state, AST_NODE *node, VALUE *result)
+{
+  ERROR_HANDLER handler = {
+      .window = state->window,
+      .frame = state->frame,
+      .held = state->held,
+      .call_depth = state->call_stack.depth,
+  };
+  ERROR_HANDLER *outer_handler = state->error_handler;
+  SCOPE *entry_scope = state->current_scope;
+  VALUE const *entry_inline_args = state->inline_args;
+
+  bool ok = true;
+  state->error_handler = &handler;
+  if (setjmp(handler.jump) == 0)
+    *result = EvaluateNode(state, node);
+  else
+  {
+    while (state->current_scope != entry_scope)
+      PopScope(state);
+    state->inline_args = entry_inline_args;
+    ok = false;
+  }
+  state->error_handler = outer_handler;
+
+  return ok;
+}
+
+bool Evaluate(INTERPRETER_STATE *state, AST_NODE *node, VALUE *result)
+{
+  TRACE_BEGIN("evaluate");
+  state->fuel = state->fuel_limit;
+  state->lambda_memory = 0;
+  state->array_memory = 0;
+  bool ok = TryEvaluate(state, node, result);
+  TRACE_END("evaluate");
+  return ok;
+}
+
+// Cost of a call relative to the other nodes when estimating argument costs.
+#define CALL_COST 100
+
+static size_t EstimateCost(AST_NODE *node)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_VARIABLE:
+    case NODE_LAMBDA:
+    case NODE_PARAMETER:
+      return 1;
+    case NODE_BINARY_OPERATION:
+      return 1 + EstimateCost(node->binary_operation.left) +
+             EstimateCost(node->binary_operation.right);
+    case NODE_ASSIGNMENT:
+      return 1 + EstimateCost(node->assignment.value);
+    case NODE_CALL: {
+      size_t cost = CALL_COST + EstimateCost(node->call.fn);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        cost += EstimateCost(node->call.args[i].value);
+      return cost;
+    }
+    case NODE_IF_ELSE: {
+      size_t if_true = EstimateCost(node->if_else.if_true);
+      size_t if_false = EstimateCost(node->if_else.if_false);
+      return 1 + EstimateCost(node->if_else.condition) + (if_true > if_false ? if_true : if_false);
+    }
+    case NODE_SEQUENCE: {
+      size_t cost = 0;
+      for (size_t i = 0; i < node->sequence.count; i++)
+        cost += EstimateCost(node->sequence.items[i]);
+      return cost;
+    }
+    case NODE_LAZY:
+      // Only found in lambda bodies, which are not part of the cost of creating the lambda.
+      return 1;
+    case NODE_ARRAY: {
+      size_t cost = 1;
+      for (size_t i = 0; i < node->array.count; i++)
+        cost += EstimateCost(node->array.items[i]);
+      return cost;
+    }
+    case NODE_INDEX:
+      return 1 + EstimateCost(node->index.array) + EstimateCost(node->index.index);
+    case NODE_FRAME:
+      return EstimateCost(node->frame.body);
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      return 1 + EstimateCost(node->temporary.value);
+    case NODE_LOAD_TEMPORARY:
+      return 1;
+  }
+
+  unreachable();
+}
+
+// Assignments write to the current scope, which concurrently evaluated arguments share. With
+// `temporaries` set, so do stores and invariants to the temporaries of the current frame; serially
+// evaluated arguments write those to the caller's frame in whichever scope they run, so only what
+// the stored values assign counts for them. Lambda bodies are not evaluated by creating the lambda,
+// so they do not count.
+static bool HasAssignment(AST_NODE *node, bool temporaries)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_VARIABLE:
+    case NODE_LAMBDA:
+    case NODE_PARAMETER:
+      return false;
+    case NODE_BINARY_OPERATION:
+      return HasAssignment(node->binary_operation.left, temporaries) ||
+             HasAssignment(node->binary_operation.right, temporaries);
+    case NODE_ASSIGNMENT:
+      return true;
+    case NODE_CALL:
+      if (HasAssignment(node->call.fn, temporaries))
+        return true;
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        if (HasAssignment(node->call.args[i].value, temporaries))
+          return true;
+      return false;
+    case NODE_IF_ELSE:
+      return HasAssignment(node->if_else.condition, temporaries) ||
+             HasAssignment(node->if_else.if_true, temporaries) ||
+             HasAssignment(node->if_else.if_false, temporaries);
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        if (HasAssignment(node->sequence.items[i], temporaries))
+          return true;
+      return false;
+    case NODE_LAZY:
+      return false;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        if (HasAssignment(node->array.items[i], temporaries))
+          return true;
+      return false;
+    case NODE_INDEX:
+      return HasAssignment(node->index.array, temporaries) ||
+             HasAssignment(node->index.index, temporaries);
+    case NODE_FRAME:
+      return HasAssignment(node->frame.body, temporaries);
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      return temporaries || HasAssignment(node->temporary.value, temporaries);
+    case NODE_LOAD_TEMPORARY:
+      return false;
+  }
+
+  unreachable();
+}
+
+// Only depends on the call's subtree, so calls shared between trees get the same flags.
+static void AnalyzeCallArguments(AST_NODE *node, size_t threshold)
+{
+  FN_ARG *args = node->call.args;
+  node->call.parallel = false;
+  size_t expensive = 0;
+  for (size_t i = 0; i < node->call.arg_count; i++)
+  {
+    if (HasAssignment(args[i].value, true))
+      return;
+    if (EstimateCost(args[i].value) >= threshold)
+      expensive++;
+  }
+  if (expensive < 2)
+    return;
+
+  node->call.parallel = true;
+  for (size_t i = 0; i < node->call.arg_count; i++)
+    args[i].spawn = EstimateCost(args[i].value) >= threshold;
+}
+
+void AnalyzeParallelCalls(AST_NODE *node, size_t threshold)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_VARIABLE:
+    case NODE_PARAMETER:
+      break;
+    case NODE_BINARY_OPERATION:
+      AnalyzeParallelCalls(node->binary_operation.left, threshold);
+      AnalyzeParallelCalls(node->binary_operation.right, threshold);
+      break;
+    case NODE_ASSIGNMENT:
+      AnalyzeParallelCalls(node->assignment.value, threshold);
+      break;
+    case NODE_LAMBDA:
+      AnalyzeParallelCalls(node->lambda.body, threshold);
+      break;
+    case NODE_CALL:
+      AnalyzeParallelCalls(node->call.fn, threshold);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        AnalyzeParallelCalls(node->call.args[i].value, threshold);
+      AnalyzeCallArguments(node, threshold);
+      break;
+    case NODE_IF_ELSE:
+      AnalyzeParallelCalls(node->if_else.condition, threshold);
+      AnalyzeParallelCalls(node->if_else.if_true, threshold);
+      AnalyzeParallelCalls(node->if_else.if_false, threshold);
+      break;
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        AnalyzeParallelCalls(node->sequence.items[i], threshold);
+      break;
+    case NODE_LAZY: {
+      // Bodies that have not been parsed yet are analysed by EvaluateLazy.
+      AST_NODE *body = atomic_load(&node->lazy.body);
+      if (body != NULL)
+        AnalyzeParallelCalls(body, threshold);
+      break;
+    }
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        AnalyzeParallelCalls(node->array.items[i], threshold);
+      break;
+    case NODE_INDEX:
+      AnalyzeParallelCalls(node->index.array, threshold);
+      AnalyzeParallelCalls(node->index.index, threshold);
+      break;
+    case NODE_FRAME:
+      AnalyzeParallelCalls(node->frame.body, threshold);
+      break;
+    case NODE_STORE_TEMPORARY:
+    case NODE_INVARIANT:
+      AnalyzeParallelCalls(node->temporary.value, threshold);
+      break;
+    case NODE_LOAD_TEMPORARY:
+      break;
+  }
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "optimize.h"
 #include "parser.h"
+#include "pool.h"
 #include "value.h"
 
 typedef struct
@@ -9,18 +15,165 @@ typedef struct
   VALUE value;
 } VARIABLE;
 
+// Function scopes hold few variables and are searched linearly. The global scope is an
+// open-addressing hash table so that large programs can define many globals; `hashed` tells the
+// two apart. Both grow when they fill up.
 typedef struct SCOPE
 {
   struct SCOPE *upper_scope;
   VARIABLE *variables;
+  size_t count;
+  size_t capacity;
+  bool hashed;
+  // The lambda called in this scope. The scope keeps it alive until it is popped, also when that
+  // happens while unwinding after an error, even if the body reassigns the variable it came from.
+  VALUE callee;
 } SCOPE;
 
+// The parameters of a leaf lambda being called, kept on the native stack instead of in a scope.
+// Leaves make no calls, so no scope is pushed while a window holds their parameters, and variables
+// are looked up in the innermost window before the scope chain. Windows hold references to their
+// values like scopes do and are unwound along with them after an error.
+#define LEAF_WINDOW_SIZE 8
+
+typedef struct LEAF_WINDOW
+{
+  struct LEAF_WINDOW *outer;
+  FN_PARAM const *params;
+  VALUE values[LEAF_WINDOW_SIZE];
+  size_t count;
+  // Keeps the lambda alive, as SCOPE's callee does.
+  VALUE callee;
+} LEAF_WINDOW;
+
+// The temporaries of an optimized body being evaluated, also kept on the native stack and unwound
+// along with scopes and windows. `code` and `scope` tell the calls the body makes to itself which
+// activation made them; see EvaluateFrame.
+typedef struct TEMPORARY_FRAME
+{
+  struct TEMPORARY_FRAME *outer;
+  AST_NODE const *code;
+  SCOPE *scope;
+  size_t count;
+  // Whether this activation may take the invariants of `outer` over.
+  bool inherits;
+  bool filled[FRAME_MAX_TEMPORARIES];
+  VALUE values[FRAME_MAX_TEMPORARIES];
+} TEMPORARY_FRAME;
+
+// Values a C function holds on to while it evaluates more code, such as the arguments of a builtin
+// evaluated so far. They are kept on the native stack too and released if an error unwinds past
+// them; see HoldValues.
+typedef struct HELD_VALUES
+{
+  struct HELD_VALUES *outer;
+  VALUE *values;
+  size_t count;
+} HELD_VALUES;
+
+// Where RuntimeError jumps to. Windows, frames and held values live in the native stack frames
+// the jump discards, so RuntimeError unwinds them down to the ones recorded here before jumping. It
+// also drops the call frames above `call_depth`, ending their trace events.
 typedef struct
+{
+  jmp_buf jump;
+  LEAF_WINDOW *window;
+  TEMPORARY_FRAME *frame;
+  HELD_VALUES *held;
+  size_t call_depth;
+} ERROR_HANDLER;
+
+// Shadow stack of the tan functions currently being called, maintained by EvaluateCall so that the
+// sampling profiler can snapshot it from a signal handler. Frames deeper than
+// CALL_STACK_MAX_FRAMES are counted but not recorded.
+#define CALL_STACK_MAX_FRAMES 256
+
+typedef struct
+{
+  char const *frames[CALL_STACK_MAX_FRAMES];
+  volatile size_t depth;
+} CALL_STACK;
+
+#define INTERPRETER_ERROR_LEN 256
+// Calls between two yields of a cooperatively scheduled state; see `yield` below.
+#define YIELD_CHECK_INTERVAL 1024
+
+// Interpreter states share nothing with each other, so independent states can be used from
+// different threads at the same time. Runtime errors are reported through the state instead of
+// aborting the process; the only process-wide facilities are the profiler, which samples a single
+// state, and stderr, which the parser writes its diagnostics to.
+typedef struct INTERPRETER_STATE
 {
   SCOPE *current_scope;
+  LEAF_WINDOW *window;
+  TEMPORARY_FRAME *frame;
+  HELD_VALUES *held;
+  // Initial capacity of function scopes.
   size_t variables_per_scope;
+  CALL_STACK call_stack;
+  ERROR_HANDLER *error_handler;
+  char error[INTERPRETER_ERROR_LEN];
+  // When set, calls marked by AnalyzeParallelCalls evaluate their expensive arguments on the pool.
+  TASK_POOL *pool;
+  // Lazily parsed lambda bodies are passed to AnalyzeParallelCalls with this threshold when they
+  // are parsed, unless it is 0.
+  size_t parallel_args_threshold;
+  // When set, lambda bodies are rewritten by OptimizeBody when they are first called.
+  bool optimize;
+  // Cooperative scheduling: every YIELD_CHECK_INTERVAL calls EvaluateCall hands control to
+  // `yield`, which may switch away from the evaluation and resume it later.
+  size_t yield_countdown;
+  void (*yield)(struct INTERPRETER_STATE *state);
+  void *yield_context;
+  // Argument values of the inlined call whose body is being evaluated; see EvaluateInlinedCall.
+  VALUE const *inline_args;
+  // Resource limits for untrusted code. Every Evaluate starts with `fuel_limit` units of fuel and
+  // spends one per call; scopes, lambdas and arrays created by the evaluation may take up at most
+  // `memory_limit` bytes. Exceeding either aborts the evaluation with an error. Both default to
+  // SIZE_MAX, which is unlimited.
+  size_t fuel_limit;
+  size_t fuel;
+  size_t memory_limit;
+  size_t scope_memory;
+  size_t lambda_memory;
+  size_t array_memory;
 } INTERPRETER_STATE;
 
 INTERPRETER_STATE NewInterpreterState(size_t variables_per_scope);
+// Gives `state` the resource limits, pool and evaluation settings of `settings`, for front ends
+// that create a fresh state per script.
+void CopySettings(INTERPRETER_STATE *state, INTERPRETER_STATE const *settings);
 void FreeInterpreterState(INTERPRETER_STATE *state);
-VALUE Evaluate(INTERPRETER_STATE *state, AST_NODE *node);
+// Returns false if evaluation failed, in which case state->error describes the failure. The scopes
+// and call frames the evaluation pushed are unwound, so the state can be used again, but globals it
+// assigned before the error keep their new values. A successful result must be released with
+// ReleaseValue once the caller is done with it.
+bool Evaluate(INTERPRETER_STATE *state, AST_NODE *node, VALUE *result);
+// For builtins: raises an error that aborts the current evaluation.
+_Noreturn void RuntimeError(INTERPRETER_STATE *state, char const *format, ...);
+// Until UnholdValues, the first `count` of `values` are released if an error aborts the
+// evaluation. Callers raise `held->count` as they fill in more values; holds end in reverse order.
+void HoldValues(INTERPRETER_STATE *state, HELD_VALUES *held, VALUE *values, size_t count);
+void UnholdValues(INTERPRETER_STATE *state, HELD_VALUES *held);
+// Calls a lambda or builtin, taking over the references held by `args`.
+VALUE CallFunction(INTERPRETER_STATE *state, VALUE fn, VALUE *args, size_t arg_count);
+// Charges an array of `count` items to the evaluation's memory limit before it is allocated.
+void ChargeArrayMemory(INTERPRETER_STATE *state, size_t count);
+// Runs `run` over [0, count) in consecutive chunks of `chunk_size` items. With a task pool the
+// chunks run concurrently, each on a state of its own that reads the caller's scopes; `run` must
+// not share anything else between chunks except through `context`, written per chunk. Errors and
+// fuel are collected once every chunk has finished.
+typedef void CHUNK_FN(INTERPRETER_STATE *state, size_t begin, size_t end, void *context);
+void RunChunks(INTERPRETER_STATE *state, size_t count, size_t chunk_size, CHUNK_FN *run,
+               void *context);
+// Global variables, for embedders and snapshots.
+void ForEachGlobal(INTERPRETER_STATE *state, void (*visit)(VARIABLE *var, void *context),
+                   void *context);
+void DefineGlobal(INTERPRETER_STATE *state, char const *name, VALUE value);
+// Returns NULL if there is no global `name`.
+VALUE const *FindGlobal(INTERPRETER_STATE *state, char const *name);
+// Marks the calls whose arguments can be evaluated in parallel: every argument is free of
+// assignments and at least two have an estimated cost of `threshold` or more. Those arguments are
+// then evaluated concurrently in the caller's scope, so they do not see the parameters bound by
+// earlier arguments of the same call the way serially evaluated arguments do.
+void AnalyzeParallelCalls(AST_NODE *node, size_t threshold);
@@ -38,6 +38,10 @@ char const *TokenKindName(TOKEN_KIND kind)
       return "'{'";
     case TOKEN_CBRACE:
       return "'}'";
+    case TOKEN_OBRACKET:
+      return "'['";
+    case TOKEN_CBRACKET:
+      return "']'";
     case TOKEN_FN:
       return "'fn'";
     case TOKEN_IF:
@@ -84,6 +88,9 @@ static void IdentToken(char const **source, TOKEN *token)
 
 void NextToken(char const **source, TOKEN *token)
 {
+  while (isspace(CURRENT_CHAR(source)))
+    ADVANCE(source);
+
   if (CURRENT_CHAR(source) == 0)
   {
     token->kind = TOKEN_EOF;
@@ -92,9 +99,6 @@ void NextToken(char const **source, TOKEN *token)
     return;
   }
 
-  while (isspace(CURRENT_CHAR(source)))
-    ADVANCE(source);
-
   if (strncmp("fn", *source, 2) == 0)
   {
     token->kind = TOKEN_FN;
@@ -187,6 +191,12 @@ void NextToken(char const **source, TOKEN *token)
     case '}':
       SINGLE_CHAR_TOK(TOKEN_CBRACE);
       return;
+    case '[':
+      SINGLE_CHAR_TOK(TOKEN_OBRACKET);
+      return;
+    case ']':
+      SINGLE_CHAR_TOK(TOKEN_CBRACKET);
+      return;
   }
 #undef SINGLE_CHAR_TOK
 
@@ -18,6 +18,8 @@ typedef enum
   TOKEN_CPAREN,
   TOKEN_OBRACE,
   TOKEN_CBRACE,
+  TOKEN_OBRACKET,
+  TOKEN_CBRACKET,
   TOKEN_FN,
   TOKEN_IF,
   TOKEN_ELSE,
@@ -1,9 +1,142 @@
 #include <history.h>
 #include <readline.h>
 #include <stdbool.h>
+#include <string.h>
 
+#include "cache.h"
 #include "interpreter.h"
 #include "parser.h"
+#include "profiler.h"
+#include "runner.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
+
+typedef struct
+{
+  char const **script_paths;
+  size_t script_count;
+  size_t jobs;
+  uint64_t slice_us;
+  char const *profile_path;
+  unsigned profile_frequency;
+  bool print_stats;
+  char const *trace_path;
+  size_t trace_buffer_events;
+  size_t parallel_args_threshold;
+  bool parallel_builtins;
+  bool optimize;
+  size_t fuel_limit;
+  size_t memory_limit;
+  char const *cache_dir;
+  bool share_ast;
+  bool lazy_parse;
+  char const *snapshot_path;
+  char const *save_snapshot_path;
+} OPTIONS;
+
+static void PrintUsage(void)
+{
+  fprintf(stderr, "Usage: tan [OPTIONS] [SCRIPT...]\n"
+                  "  --jobs N                   run the scripts on N worker threads\n"
+                  "  --slice MICROSECONDS       interleave the scripts on one thread, switching\n"
+                  "                             between them after each time slice\n"
+                  "  --parallel-args COST       evaluate call arguments costing at least COST\n"
+                  "                             concurrently\n"
+                  "  --parallel-builtins        run the chunks of map and reduce concurrently\n"
+                  "  --optimize                 reuse values that lambda bodies evaluate more\n"
+                  "                             than once or that stay the same across\n"
+                  "                             recursive calls\n"
+                  "  --cache-dir DIR            keep parsed scripts in DIR to skip parsing them\n"
+                  "                             again\n"
+                  "  --share-ast                share structurally identical subtrees between\n"
+                  "                             and within programs\n"
+                  "  --lazy-parse               parse function bodies when they are first called\n"
+                  "  --snapshot FILE            start with the global variables saved in FILE\n"
+                  "  --save-snapshot FILE       save the global variables to FILE at exit\n"
+                  "  --fuel N                   abort evaluations making more than N calls\n"
+                  "  --memory-limit BYTES       abort evaluations using more scope, lambda and\n"
+                  "                             array memory than BYTES\n"
+                  "  --profile FILE             write a folded-stack profile to FILE\n"
+                  "  --profile-frequency HZ     sampling frequency of the profiler\n"
+                  "  --stats                    print interpreter counters at exit\n"
+                  "  --trace FILE               write a Chrome trace-event file to FILE\n"
+                  "  --trace-buffer EVENTS      events kept per thread while tracing\n");
+}
+
+static bool ParseOptions(int argc, char **argv, OPTIONS *options)
+{
+  *options = (OPTIONS){
+      .script_paths = malloc(sizeof(char const *) * argc),
+      .profile_frequency = 1000,
+      .trace_buffer_events = 1 << 18,
+      .fuel_limit = SIZE_MAX,
+      .memory_limit = SIZE_MAX,
+  };
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      options->profile_path = argv[++i];
+    else if (strcmp(argv[i], "--profile-frequency") == 0 && i + 1 < argc)
+      options->profile_frequency = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--stats") == 0)
+      options->print_stats = true;
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      options->trace_path = argv[++i];
+    else if (strcmp(argv[i], "--trace-buffer") == 0 && i + 1 < argc)
+      options->trace_buffer_events = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--parallel-args") == 0 && i + 1 < argc)
+      options->parallel_args_threshold = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--parallel-builtins") == 0)
+      options->parallel_builtins = true;
+    else if (strcmp(argv[i], "--optimize") == 0)
+      options->optimize = true;
+    else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc)
+      options->cache_dir = argv[++i];
+    else if (strcmp(argv[i], "--share-ast") == 0)
+      options->share_ast = true;
+    else if (strcmp(argv[i], "--lazy-parse") == 0)
+      options->lazy_parse = true;
+    else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+      options->snapshot_path = argv[++i];
+    else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc)
+      options->save_snapshot_path = argv[++i];
+    else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc)
+      options->fuel_limit = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+      options->memory_limit = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+      options->jobs = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc)
+      options->slice_us = strtoull(argv[++i], NULL, 10);
+    else if (argv[i][0] != '-')
+      options->script_paths[options->script_count++] = argv[i];
+    else
+      return false;
+  }
+
+  // Profiling samples a single interpreter, so it cannot follow several scripts.
+  if (options->profile_path != NULL &&
+      (options->script_count > 1 || options->jobs > 0 || options->slice_us > 0))
+    return false;
+
+  return true;
+}
+
+static void PrepareProgram(OPTIONS const *options, AST_NODE *ast)
+{
+  if (options->parallel_args_threshold > 0)
+    AnalyzeParallelCalls(ast, options->parallel_args_threshold);
+}
+
+static void PrintResult(VALUE *result)
+{
+  putc('\t', stdout);
+  PrintValue(result);
+  putc('\n', stdout);
+}
 
 // ---------------
 // REPL
@@ -22,30 +155,188 @@ bool ReadInput(char const *prompt, char **line)
   return true;
 }
 
-int main(void)
+static void RunREPL(INTERPRETER_STATE *interpreter, OPTIONS const *options)
 {
-  INTERPRETER_STATE interpreter = NewInterpreterState(256);
-
   char *line;
   while (ReadInput(">> ", &line))
   {
     if (!*line)
       continue;
 
+    if (strcmp(line, ":stats") == 0)
+    {
+      PrintStats(stdout);
+      free(line);
+      continue;
+    }
+
     char const *source = line;
     AST_NODE *ast = ParseProgram(source);
 
-    VALUE result = Evaluate(&interpreter, ast);
-    putc('\t', stdout);
-    PrintValue(&result);
-    putc('\n', stdout);
+    if (ast != NULL)
+    {
+      PrepareProgram(options, ast);
+
+      VALUE result;
+      if (Evaluate(interpreter, ast, &result))
+      {
+        PrintResult(&result);
+        ReleaseValue(&result);
+      }
+      else
+        fprintf(stderr, "%s\n", interpreter->error);
 
-    FreeAST(ast);
+      CollectProfileSamples();
+      FreeAST(ast);
+    }
 
     free(line);
   }
+}
+
+static bool RunInterleaved(INTERPRETER_STATE *interpreter, OPTIONS const *options)
+{
+  SCHEDULER *scheduler = NewScheduler(options->slice_us, interpreter);
+
+  bool ok = true;
+  for (size_t i = 0; i < options->script_count; i++)
+    ok = SpawnScript(scheduler, options->script_paths[i]) && ok;
+  ok = RunScheduler(scheduler) && ok;
+
+  FreeScheduler(scheduler);
+  return ok;
+}
+
+static bool RunScript(INTERPRETER_STATE *interpreter, OPTIONS const *options, char const *path)
+{
+  char *source = ReadFile(path);
+  if (source == NULL)
+  {
+    fprintf(stderr, "Could not read script '%s'.\n", path);
+    return false;
+  }
+
+  AST_NODE *ast = options->cache_dir != NULL ? ParseProgramCached(source, options->cache_dir)
+                                             : ParseProgram(source);
+  free(source);
+  if (ast == NULL)
+    return false;
+
+  PrepareProgram(options, ast);
+
+  VALUE result;
+  bool ok = Evaluate(interpreter, ast, &result);
+  if (ok)
+  {
+    PrintResult(&result);
+    ReleaseValue(&result);
+  }
+  else
+    fprintf(stderr, "%s: %s\n", path, interpreter->error);
+
+  CollectProfileSamples();
+  FreeAST(ast);
+
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  OPTIONS options;
+  if (!ParseOptions(argc, argv, &options))
+  {
+    PrintUsage();
+    return 1;
+  }
+
+  SetASTSharing(options.share_ast);
+  SetLazyParsing(options.lazy_parse);
+
+  INTERPRETER_STATE interpreter = NewInterpreterState(8);
+  interpreter.fuel_limit = options.fuel_limit;
+  interpreter.memory_limit = options.memory_limit;
+  interpreter.parallel_args_threshold = options.parallel_args_threshold;
+  interpreter.optimize = options.optimize;
+
+  if (options.snapshot_path != NULL && !LoadSnapshot(&interpreter, options.snapshot_path))
+  {
+    fprintf(stderr, "Could not load snapshot '%s'.\n", options.snapshot_path);
+    return 1;
+  }
+
+  if (options.profile_path != NULL && !StartProfiler(&interpreter, options.profile_frequency))
+  {
+    fprintf(stderr, "Could not start the profiler.\n");
+    return 1;
+  }
+
+  if (options.trace_path != NULL)
+    StartTracing(options.trace_buffer_events);
+
+  // Parallel evaluation is opt-in, so that serial runs start no threads.
+  if (options.parallel_args_threshold > 0 || options.parallel_builtins)
+    interpreter.pool = NewTaskPool(DefaultWorkerCount());
+
+  bool ok = true;
+  if (options.slice_us > 0)
+    ok = RunInterleaved(&interpreter, &options);
+  else if (options.script_count > 1 || options.jobs > 0)
+    ok = RunScripts(options.script_paths, options.script_count,
+                    options.jobs > 0 ? options.jobs : DefaultWorkerCount(), &interpreter);
+  else if (options.script_count == 1)
+    ok = RunScript(&interpreter, &options, options.script_paths[0]);
+  else
+    RunREPL(&interpreter, &options);
+
+  if (options.profile_path != NULL)
+  {
+    StopProfiler();
+
+    FILE *profile = fopen(options.profile_path, "w");
+    if (profile != NULL)
+    {
+      WriteFoldedStacks(profile);
+      fclose(profile);
+    }
+    else
+    {
+      fprintf(stderr, "Could not write profile '%s'.\n", options.profile_path);
+      ok = false;
+    }
+    FreeProfile();
+  }
+
+  if (options.trace_path != NULL)
+  {
+    StopTracing();
+
+    FILE *trace = fopen(options.trace_path, "w");
+    if (trace != NULL)
+    {
+      WriteChromeTrace(trace);
+      fclose(trace);
+    }
+    else
+    {
+      fprintf(stderr, "Could not write trace '%s'.\n", options.trace_path);
+      ok = false;
+    }
+    FreeTrace();
+  }
+
+  if (options.save_snapshot_path != NULL && !SaveSnapshot(&interpreter, options.save_snapshot_path))
+  {
+    fprintf(stderr, "Could not save snapshot '%s'.\n", options.save_snapshot_path);
+    ok = false;
+  }
+
+  if (options.print_stats)
+    PrintStats(stderr);
 
+  if (interpreter.pool != NULL)
+    FreeTaskPool(interpreter.pool);
   FreeInterpreterState(&interpreter);
+  free(options.script_paths);
 
-  return 0;
+  return ok ? 0 : 1;
 }
@@ -0,0 +1,832 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "unreachable.h"
+
+// Bodies with more nodes than this are left alone, as value numbering compares every new value
+// with the ones numbered before it.
+#define OPTIMIZE_MAX_VALUES 1024
+
+// ---------------
+// SSA form
+// ---------------
+
+// A body is lowered to one SSA value per node, in evaluation order. Variables are not values of
+// their own: reading one yields the value last assigned to it in the body or, failing that, an
+// entry value standing for whatever the scope chain holds for it. If-else merges define every
+// variable assigned in either branch anew, as a phi.
+//
+// Scoping is dynamic, so callees read the caller's variables too: calls take the environment as an
+// operand, a value that every assignment replaces. Arguments are evaluated in the callee's scope,
+// where the parameters bound by earlier arguments can shadow the caller's variables, so entry
+// values read there, and calls made there, belong to a context numbered after the callee, the
+// earlier arguments and the environment. Assignments there only bind variables of the callee.
+//
+// Values are numbered by their key: equal operations on equally numbered operands compute the
+// same value and get the same number.
+
+typedef enum
+{
+  KEY_UNIQUE,
+  KEY_CONSTANT,
+  KEY_ENTRY,
+  KEY_BINARY,
+  KEY_CALL,
+  KEY_INDEX,
+  KEY_ARRAY,
+  KEY_CONTEXT,
+} KEY_KIND;
+
+typedef struct
+{
+  KEY_KIND kind;
+  union
+  {
+    double number;
+    char const *name;
+    BINARY_OPERATION_KIND op;
+  };
+  size_t first_operand;
+  size_t operand_count;
+} VALUE_KEY;
+
+// Numbers every body starts out with.
+#define BODY_CONTEXT 0
+#define ENTRY_ENVIRONMENT 1
+
+typedef enum
+{
+  REUSE_NONE,
+  // Keeps the value for later evaluations of the same value.
+  REUSE_STORE,
+  // Replaced by the value kept by an earlier evaluation, or by the constant it always is.
+  REUSE_LOAD,
+  REUSE_CONSTANT,
+  // Evaluated once for a chain of recursive calls.
+  REUSE_INVARIANT,
+} REUSE;
+
+typedef struct
+{
+  AST_NODE *node;
+  size_t number;
+  // One past the last value of the node's subtree.
+  size_t end;
+  // The innermost if-else branch the node is evaluated in, 0 being the body itself.
+  size_t region;
+  // Whether the node has no effects, so that it can be replaced by an earlier value with the same
+  // number.
+  bool pure;
+  // Whether the node only reads variables the body neither binds nor assigns and makes no calls,
+  // so that it evaluates to the same value in the calls the body makes to itself.
+  bool invariant;
+  bool reads_variables;
+  // Arguments of parallel calls may be evaluated on other threads, and calls are only inlined
+  // while they name their callee, so both are left as they are.
+  bool sealed;
+  // Inside a subtree that is not evaluated any more.
+  bool removed;
+  REUSE reuse;
+  size_t slot;
+} SSA_VALUE;
+
+typedef struct
+{
+  char const *name;
+  size_t number;
+} DEFINITION;
+
+typedef struct
+{
+  SSA_VALUE *values;
+  size_t value_count;
+  size_t value_capacity;
+  VALUE_KEY *keys;
+  size_t key_count;
+  size_t key_capacity;
+  size_t *operands;
+  size_t operand_count;
+  size_t operand_capacity;
+  size_t *region_parents;
+  size_t region_count;
+  size_t region_capacity;
+  DEFINITION *definitions;
+  size_t definition_count;
+  size_t definition_capacity;
+  // Parameters and the variables assigned anywhere in the body.
+  FN_PARAM const *params;
+  size_t param_count;
+  char const **assigned;
+  size_t assigned_count;
+  size_t assigned_capacity;
+  // Where the node being lowered is evaluated. Definitions below `visible` belong to the caller of
+  // the call whose argument is being lowered.
+  size_t environment;
+  size_t context;
+  size_t visible;
+  size_t region;
+  size_t parallel_depth;
+  bool has_calls;
+  bool too_large;
+  // Slot of each temporary, by the number of the value it holds.
+  size_t slot_numbers[FRAME_MAX_TEMPORARIES];
+  size_t slot_count;
+} SSA;
+
+static void *Grow(void *data, size_t *capacity, size_t needed, size_t element_size)
+{
+  if (needed <= *capacity)
+    return data;
+  while (*capacity < needed)
+    *capacity = *capacity ? *capacity * 2 : 64;
+  return realloc(data, *capacity * element_size);
+}
+
+static bool SameKey(SSA const *ssa, VALUE_KEY const *key, VALUE_KEY const *other,
+                    size_t const *operands)
+{
+  if (key->kind != other->kind || key->operand_count != other->operand_count)
+    return false;
+
+  switch (key->kind)
+  {
+    case KEY_UNIQUE:
+      return false;
+    case KEY_CONSTANT:
+      if (memcmp(&key->number, &other->number, sizeof(double)) != 0)
+        return false;
+      break;
+    case KEY_ENTRY:
+      if (strcmp(key->name, other->name) != 0)
+        return false;
+      break;
+    case KEY_BINARY:
+      if (key->op != other->op)
+        return false;
+      break;
+    case KEY_CALL:
+    case KEY_INDEX:
+    case KEY_ARRAY:
+    case KEY_CONTEXT:
+      break;
+  }
+
+  // Compared and copied in loops, as keys without operands come with NULL operands.
+  for (size_t i = 0; i < key->operand_count; i++)
+    if (ssa->operands[key->first_operand + i] != operands[i])
+      return false;
+  return true;
+}
+
+// Returns the number of the value `key` computes from the values numbered by `operands`: the
+// number of an equal key numbered before, or a new one.
+static size_t NumberValue(SSA *ssa, VALUE_KEY key, size_t const *operands)
+{
+  for (size_t i = 0; i < ssa->key_count; i++)
+    if (SameKey(ssa, &ssa->keys[i], &key, operands))
+      return i;
+
+  ssa->operands = Grow(ssa->operands, &ssa->operand_capacity,
+                       ssa->operand_count + key.operand_count, sizeof(size_t));
+  for (size_t i = 0; i < key.operand_count; i++)
+    ssa->operands[ssa->operand_count + i] = operands[i];
+  key.first_operand = ssa->operand_count;
+  ssa->operand_count += key.operand_count;
+
+  ssa->keys = Grow(ssa->keys, &ssa->key_capacity, ssa->key_count + 1, sizeof(VALUE_KEY));
+  ssa->keys[ssa->key_count] = key;
+  return ssa->key_count++;
+}
+
+static size_t UniqueValue(SSA *ssa)
+{
+  return NumberValue(ssa, (VALUE_KEY){.kind = KEY_UNIQUE}, NULL);
+}
+
+static size_t NewRegion(SSA *ssa, size_t parent)
+{
+  ssa->region_parents = Grow(ssa->region_parents, &ssa->region_capacity, ssa->region_count + 1,
+                             sizeof(size_t));
+  ssa->region_parents[ssa->region_count] = parent;
+  return ssa->region_count++;
+}
+
+static void Define(SSA *ssa, char const *name, size_t number)
+{
+  ssa->definitions = Grow(ssa->definitions, &ssa->definition_capacity,
+                          ssa->definition_count + 1, sizeof(DEFINITION));
+  ssa->definitions[ssa->definition_count++] = (DEFINITION){.name = name, .number = number};
+}
+
+static void CollectAssignments(SSA *ssa, AST_NODE *node)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_VARIABLE:
+    case NODE_LAMBDA:
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      break;
+    case NODE_BINARY_OPERATION:
+      CollectAssignments(ssa, node->binary_operation.left);
+      CollectAssignments(ssa, node->binary_operation.right);
+      break;
+    case NODE_ASSIGNMENT:
+      ssa->assigned = Grow(ssa->assigned, &ssa->assigned_capacity, ssa->assigned_count + 1,
+                           sizeof(char const *));
+      ssa->assigned[ssa->assigned_count++] = node->assignment.var_name;
+      CollectAssignments(ssa, node->assignment.value);
+      break;
+    case NODE_CALL:
+      CollectAssignments(ssa, node->call.fn);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        CollectAssignments(ssa, node->call.args[i].value);
+      break;
+    case NODE_IF_ELSE:
+      CollectAssignments(ssa, node->if_else.condition);
+      CollectAssignments(ssa, node->if_else.if_true);
+      CollectAssignments(ssa, node->if_else.if_false);
+      break;
+    case NODE_SEQUENCE:
+      for (size_t i = 0; i < node->sequence.count; i++)
+        CollectAssignments(ssa, node->sequence.items[i]);
+      break;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        CollectAssignments(ssa, node->array.items[i]);
+      break;
+    case NODE_INDEX:
+      CollectAssignments(ssa, node->index.array);
+      CollectAssignments(ssa, node->index.index);
+      break;
+  }
+}
+
+// Whether `name` may be bound in the body's own scope, so that recursive calls see it differently.
+static bool IsLocal(SSA const *ssa, char const *name)
+{
+  for (size_t i = 0; i < ssa->param_count; i++)
+    if (strcmp(ssa->params[i].name, name) == 0)
+      return true;
+  for (size_t i = 0; i < ssa->assigned_count; i++)
+    if (strcmp(ssa->assigned[i], name) == 0)
+      return true;
+  return false;
+}
+
+static size_t ReadVariable(SSA *ssa, char const *name, bool *invariant)
+{
+  for (size_t i = ssa->definition_count; i-- > ssa->visible;)
+    if (strcmp(ssa->definitions[i].name, name) == 0)
+    {
+      *invariant = false;
+      return ssa->definitions[i].number;
+    }
+
+  *invariant = ssa->context == BODY_CONTEXT && !IsLocal(ssa, name);
+  size_t operands[] = {ssa->context};
+  return NumberValue(ssa, (VALUE_KEY){.kind = KEY_ENTRY, .name = name, .operand_count = 1},
+                     operands);
+}
+
+static size_t Lower(SSA *ssa, AST_NODE *node);
+
+static size_t LowerIfElse(SSA *ssa, AST_NODE *node)
+{
+  Lower(ssa, node->if_else.condition);
+
+  size_t entry_definitions = ssa->definition_count;
+  size_t entry_environment = ssa->environment;
+  size_t region = ssa->region;
+  bool environment_changed = false;
+  char const **merged = NULL;
+  size_t merged_count = 0;
+  size_t merged_capacity = 0;
+
+  AST_NODE *branches[] = {node->if_else.if_true, node->if_else.if_false};
+  for (size_t i = 0; i < 2; i++)
+  {
+    ssa->region = NewRegion(ssa, region);
+    Lower(ssa, branches[i]);
+    for (size_t j = entry_definitions; j < ssa->definition_count; j++)
+    {
+      merged = Grow(merged, &merged_capacity, merged_count + 1, sizeof(char const *));
+      merged[merged_count++] = ssa->definitions[j].name;
+    }
+    environment_changed = environment_changed || ssa->environment != entry_environment;
+    ssa->definition_count = entry_definitions;
+    ssa->environment = entry_environment;
+  }
+  ssa->region = region;
+
+  for (size_t i = 0; i < merged_count; i++)
+    Define(ssa, merged[i], UniqueValue(ssa));
+  if (environment_changed)
+    ssa->environment = UniqueValue(ssa);
+  free(merged);
+
+  return UniqueValue(ssa);
+}
+
+static size_t LowerCall(SSA *ssa, AST_NODE *node, bool *pure)
+{
+  ssa->has_calls = true;
+
+  size_t count = node->call.arg_count;
+  // The callee, the arguments and the environment.
+  size_t *operands = malloc(sizeof(size_t) * (count + 2));
+  size_t fn = Lower(ssa, node->call.fn);
+  if (node->call.fn->kind == NODE_VARIABLE)
+    ssa->values[fn].sealed = true;
+  operands[0] = ssa->values[fn].number;
+  *pure = ssa->values[fn].pure && !node->call.parallel;
+
+  size_t environment = ssa->environment;
+  size_t context = ssa->context;
+  size_t visible = ssa->visible;
+  size_t definition_count = ssa->definition_count;
+  if (node->call.parallel)
+    ssa->parallel_depth++;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (node->call.parallel)
+    {
+      ssa->context = UniqueValue(ssa);
+      ssa->environment = ssa->context;
+      ssa->visible = ssa->definition_count;
+    }
+    else if (i > 0)
+    {
+      // Evaluated once the parameters of the earlier arguments are bound.
+      operands[i + 1] = ssa->environment;
+      ssa->context = NumberValue(ssa, (VALUE_KEY){.kind = KEY_CONTEXT, .operand_count = i + 2},
+                                 operands);
+      ssa->environment = ssa->context;
+      ssa->visible = ssa->definition_count;
+    }
+
+    size_t arg = Lower(ssa, node->call.args[i].value);
+    operands[i + 1] = ssa->values[arg].number;
+    *pure = *pure && ssa->values[arg].pure;
+  }
+
+  if (node->call.parallel)
+    ssa->parallel_depth--;
+  ssa->environment = environment;
+  ssa->context = context;
+  ssa->visible = visible;
+  ssa->definition_count = definition_count;
+
+  operands[count + 1] = environment;
+  size_t number =
+      *pure ? NumberValue(ssa, (VALUE_KEY){.kind = KEY_CALL, .operand_count = count + 2}, operands)
+            : UniqueValue(ssa);
+  free(operands);
+  return number;
+}
+
+// Numbers the operation of value `index` on the values of its `children`.
+static size_t LowerOperation(SSA *ssa, size_t index, VALUE_KEY key, size_t const *children)
+{
+  size_t *operands = malloc(sizeof(size_t) * (key.operand_count + 1));
+  SSA_VALUE *value = &ssa->values[index];
+  value->pure = true;
+  value->invariant = true;
+  for (size_t i = 0; i < key.operand_count; i++)
+  {
+    SSA_VALUE const *child = &ssa->values[children[i]];
+    operands[i] = child->number;
+    value->pure = value->pure && child->pure;
+    value->invariant = value->invariant && child->invariant;
+    value->reads_variables = value->reads_variables || child->reads_variables;
+  }
+
+  size_t number = value->pure ? NumberValue(ssa, key, operands) : UniqueValue(ssa);
+  free(operands);
+  return number;
+}
+
+// Returns the index of the value of `node`, whose subtree's values follow it.
+static size_t Lower(SSA *ssa, AST_NODE *node)
+{
+  if (ssa->value_count >= OPTIMIZE_MAX_VALUES)
+  {
+    ssa->too_large = true;
+    return 0;
+  }
+
+  ssa->values = Grow(ssa->values, &ssa->value_capacity, ssa->value_count + 1, sizeof(SSA_VALUE));
+  size_t index = ssa->value_count++;
+  ssa->values[index] = (SSA_VALUE){
+      .node = node,
+      .region = ssa->region,
+      .sealed = ssa->parallel_depth > 0,
+      .reuse = REUSE_NONE,
+  };
+
+  size_t number;
+  bool pure = false;
+  bool invariant = false;
+  bool reads_variables = false;
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+      number = NumberValue(
+          ssa, (VALUE_KEY){.kind = KEY_CONSTANT, .number = node->constant_number}, NULL);
+      pure = invariant = true;
+      break;
+    case NODE_VARIABLE:
+      number = ReadVariable(ssa, node->variable, &invariant);
+      pure = reads_variables = true;
+      break;
+    case NODE_BINARY_OPERATION: {
+      size_t children[2];
+      children[0] = Lower(ssa, node->binary_operation.left);
+      children[1] = Lower(ssa, node->binary_operation.right);
+      number = LowerOperation(
+          ssa, index,
+          (VALUE_KEY){.kind = KEY_BINARY, .op = node->binary_operation.op, .operand_count = 2},
+          children);
+      pure = ssa->values[index].pure;
+      invariant = ssa->values[index].invariant;
+      reads_variables = ssa->values[index].reads_variables;
+      break;
+    }
+    case NODE_INDEX: {
+      size_t children[2];
+      children[0] = Lower(ssa, node->index.array);
+      children[1] = Lower(ssa, node->index.index);
+      number = LowerOperation(ssa, index, (VALUE_KEY){.kind = KEY_INDEX, .operand_count = 2},
+                              children);
+      pure = ssa->values[index].pure;
+      invariant = ssa->values[index].invariant;
+      reads_variables = ssa->values[index].reads_variables;
+      break;
+    }
+    case NODE_ARRAY: {
+      size_t *children = malloc(sizeof(size_t) * (node->array.count + 1));
+      for (size_t i = 0; i < node->array.count; i++)
+        children[i] = Lower(ssa, node->array.items[i]);
+      number = LowerOperation(
+          ssa, index, (VALUE_KEY){.kind = KEY_ARRAY, .operand_count = node->array.count},
+          children);
+      free(children);
+      pure = ssa->values[index].pure;
+      invariant = ssa->values[index].invariant;
+      reads_variables = ssa->values[index].reads_variables;
+      break;
+    }
+    case NODE_ASSIGNMENT: {
+      size_t value = Lower(ssa, node->assignment.value);
+      number = ssa->values[value].number;
+      Define(ssa, node->assignment.var_name, number);
+      ssa->environment = UniqueValue(ssa);
+      break;
+    }
+    case NODE_CALL:
+      number = LowerCall(ssa, node, &pure);
+      break;
+    case NODE_IF_ELSE:
+      number = LowerIfElse(ssa, node);
+      break;
+    case NODE_SEQUENCE: {
+      size_t last = 0;
+      for (size_t i = 0; i < node->sequence.count; i++)
+        last = Lower(ssa, node->sequence.items[i]);
+      number = ssa->values[last].number;
+      break;
+    }
+    case NODE_LAMBDA:
+    case NODE_LAZY:
+    case NODE_PARAMETER:
+    case NODE_FRAME:
+    case NODE_STORE_TEMPORARY:
+    case NODE_LOAD_TEMPORARY:
+    case NODE_INVARIANT:
+      number = UniqueValue(ssa);
+      break;
+    default:
+      unreachable();
+  }
+
+  SSA_VALUE *value = &ssa->values[index];
+  value->number = number;
+  value->end = ssa->value_count;
+  value->pure = pure;
+  value->invariant = invariant;
+  value->reads_variables = reads_variables;
+  return index;
+}
+
+// ---------------
+// Passes
+// ---------------
+
+#define NO_SLOT SIZE_MAX
+
+// Whether the node is an operation whose result temporaries can stand for; constants are cheaper
+// to evaluate, and the other nodes have effects or produce the value of a child.
+static bool Reusable(SSA_VALUE const *value)
+{
+  if (!value->pure || value->sealed || value->removed)
+    return false;
+  switch (value->node->kind)
+  {
+    case NODE_VARIABLE:
+    case NODE_BINARY_OPERATION:
+    case NODE_CALL:
+    case NODE_INDEX:
+    case NODE_ARRAY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static size_t SlotFor(SSA *ssa, size_t number)
+{
+  for (size_t i = 0; i < ssa->slot_count; i++)
+    if (ssa->slot_numbers[i] == number)
+      return i;
+  if (ssa->slot_count == FRAME_MAX_TEMPORARIES)
+    return NO_SLOT;
+  ssa->slot_numbers[ssa->slot_count] = number;
+  return ssa->slot_count++;
+}
+
+// Marks the subtree below `index` as no longer evaluated and returns its last index.
+static size_t RemoveSubtree(SSA *ssa, size_t index)
+{
+  size_t end = ssa->values[index].end;
+  for (size_t i = index + 1; i < end; i++)
+    ssa->values[i].removed = true;
+  return end - 1;
+}
+
+static bool HasReuse(SSA const *ssa, size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++)
+    if (ssa->values[i].reuse != REUSE_NONE)
+      return true;
+  return false;
+}
+
+static bool HasStore(SSA const *ssa, size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++)
+    if (ssa->values[i].reuse == REUSE_STORE)
+      return true;
+  return false;
+}
+
+// Whether values evaluated in `region` are always evaluated before `other` is entered.
+static bool Dominates(SSA const *ssa, size_t region, size_t other)
+{
+  while (other != region)
+  {
+    if (other == 0)
+      return false;
+    other = ssa->region_parents[other];
+  }
+  return true;
+}
+
+// Returns the first value that is evaluated whenever, and before, value `index` is and that
+// computes the same value, or `index` if there is none.
+static size_t FindLeader(SSA const *ssa, size_t index)
+{
+  SSA_VALUE const *value = &ssa->values[index];
+  for (size_t i = 0; i < index; i++)
+  {
+    SSA_VALUE const *leader = &ssa->values[i];
+    if (leader->number == value->number && leader->end <= index && Reusable(leader) &&
+        leader->reuse != REUSE_LOAD && leader->reuse != REUSE_CONSTANT &&
+        Dominates(ssa, leader->region, value->region))
+      return i;
+  }
+  return index;
+}
+
+// Recursion-invariant hoisting: the largest invariant expressions of bodies that make calls, and
+// so may call themselves, are evaluated once for a whole chain of recursive calls. Occurrences of
+// the same value share a slot.
+static void HoistInvariants(SSA *ssa)
+{
+  if (!ssa->has_calls)
+    return;
+
+  for (size_t i = 0; i < ssa->value_count; i++)
+  {
+    SSA_VALUE *value = &ssa->values[i];
+    if (!value->invariant || !value->reads_variables || !Reusable(value))
+      continue;
+    size_t slot = SlotFor(ssa, value->number);
+    if (slot == NO_SLOT)
+      return;
+
+    value->reuse = REUSE_INVARIANT;
+    value->slot = slot;
+    i = RemoveSubtree(ssa, i);
+  }
+}
+
+// Redundancy elimination over the value numbers, either of pure calls only or of all the other
+// expressions: a value already evaluated on every path to it is replaced by a temporary holding
+// the earlier result, and a value that is always the same constant by that constant.
+static void ReuseValues(SSA *ssa, bool calls)
+{
+  for (size_t i = 0; i < ssa->value_count; i++)
+  {
+    SSA_VALUE *value = &ssa->values[i];
+    if (value->reuse == REUSE_LOAD || value->reuse == REUSE_INVARIANT)
+    {
+      i = value->end - 1;
+      continue;
+    }
+    // Leaders stay, and so do the subtrees holding one.
+    if (value->reuse != REUSE_NONE || !Reusable(value) ||
+        (value->node->kind == NODE_CALL) != calls || HasStore(ssa, i + 1, value->end))
+      continue;
+
+    if (ssa->keys[value->number].kind == KEY_CONSTANT)
+    {
+      value->reuse = REUSE_CONSTANT;
+      i = RemoveSubtree(ssa, i);
+      continue;
+    }
+
+    size_t leader = FindLeader(ssa, i);
+    if (leader == i)
+      continue;
+    size_t slot = SlotFor(ssa, value->number);
+    if (slot == NO_SLOT)
+      continue;
+
+    if (ssa->values[leader].reuse == REUSE_NONE)
+    {
+      ssa->values[leader].reuse = REUSE_STORE;
+      ssa->values[leader].slot = slot;
+    }
+    value->reuse = REUSE_LOAD;
+    value->slot = slot;
+    i = RemoveSubtree(ssa, i);
+  }
+}
+
+// ---------------
+// Rewriting
+// ---------------
+
+static AST_NODE *NewTemporary(AST_NODE_KIND kind, size_t slot, AST_NODE *value)
+{
+  AST_NODE *node = NewASTNode(kind);
+  node->temporary.value = value;
+  node->temporary.slot = slot;
+  node->temporary.call = false;
+  return node;
+}
+
+static AST_NODE *Rewrite(SSA const *ssa, size_t *cursor);
+
+// Copies the node of `value` with its children rewritten, visiting them in the order Lower did.
+static AST_NODE *RewriteChildren(SSA const *ssa, size_t *cursor, SSA_VALUE const *value)
+{
+  AST_NODE *node = value->node;
+  if (!HasReuse(ssa, *cursor, value->end))
+  {
+    *cursor = value->end;
+    return CopyAST(node);
+  }
+
+  AST_NODE *copy = NewASTNode(node->kind);
+  switch (node->kind)
+  {
+    case NODE_BINARY_OPERATION:
+      copy->binary_operation.left = Rewrite(ssa, cursor);
+      copy->binary_operation.right = Rewrite(ssa, cursor);
+      copy->binary_operation.op = node->binary_operation.op;
+      atomic_init(&copy->binary_operation.quick, QUICK_UNSEEN);
+      break;
+    case NODE_ASSIGNMENT:
+      copy->assignment.var_name =
+          CopyName(node->assignment.var_name, strlen(node->assignment.var_name));
+      copy->assignment.value = Rewrite(ssa, cursor);
+      break;
+    case NODE_CALL:
+      copy->call.fn = Rewrite(ssa, cursor);
+      copy->call.arg_count = node->call.arg_count;
+      copy->call.args = AllocAST(sizeof(FN_ARG) * node->call.arg_count);
+      for (size_t i = 0; i < node->call.arg_count; i++)
+        copy->call.args[i] = (FN_ARG){
+            .value = Rewrite(ssa, cursor),
+            .spawn = node->call.args[i].spawn,
+        };
+      // The arguments of parallel calls are sealed, so their flags still hold.
+      copy->call.parallel = node->call.parallel;
+      atomic_init(&copy->call.site, NULL);
+      break;
+    case NODE_IF_ELSE:
+      copy->if_else.condition = Rewrite(ssa, cursor);
+      copy->if_else.if_true = Rewrite(ssa, cursor);
+      copy->if_else.if_false = Rewrite(ssa, cursor);
+      break;
+    case NODE_SEQUENCE:
+      copy->sequence.count = node->sequence.count;
+      copy->sequence.items = AllocAST(sizeof(AST_NODE *) * node->sequence.count);
+      for (size_t i = 0; i < node->sequence.count; i++)
+        copy->sequence.items[i] = Rewrite(ssa, cursor);
+      break;
+    case NODE_ARRAY:
+      copy->array.count = node->array.count;
+      copy->array.items = AllocAST(sizeof(AST_NODE *) * node->array.count);
+      for (size_t i = 0; i < node->array.count; i++)
+        copy->array.items[i] = Rewrite(ssa, cursor);
+      break;
+    case NODE_INDEX:
+      copy->index.array = Rewrite(ssa, cursor);
+      copy->index.index = Rewrite(ssa, cursor);
+      break;
+    default:
+      // The other nodes have no children that were lowered.
+      unreachable();
+  }
+  return copy;
+}
+
+static AST_NODE *Rewrite(SSA const *ssa, size_t *cursor)
+{
+  SSA_VALUE const *value = &ssa->values[(*cursor)++];
+  switch (value->reuse)
+  {
+    case REUSE_NONE:
+      return RewriteChildren(ssa, cursor, value);
+    case REUSE_STORE:
+      return NewTemporary(NODE_STORE_TEMPORARY, value->slot, RewriteChildren(ssa, cursor, value));
+    case REUSE_LOAD: {
+      *cursor = value->end;
+      AST_NODE *load = NewTemporary(NODE_LOAD_TEMPORARY, value->slot, NULL);
+      load->temporary.call = value->node->kind == NODE_CALL;
+      return load;
+    }
+    case REUSE_CONSTANT: {
+      *cursor = value->end;
+      AST_NODE *constant = NewASTNode(NODE_CONSTANT_NUMBER);
+      constant->constant_number = ssa->keys[value->number].number;
+      return constant;
+    }
+    case REUSE_INVARIANT:
+      *cursor = value->end;
+      return NewTemporary(NODE_INVARIANT, value->slot, CopyAST(value->node));
+  }
+
+  unreachable();
+}
+
+AST_NODE *OptimizeBody(AST_NODE *body, FN_PARAM const *params, size_t param_count)
+{
+  SSA ssa = {.params = params, .param_count = param_count};
+  NewRegion(&ssa, 0);
+  ssa.context = UniqueValue(&ssa);
+  ssa.environment = UniqueValue(&ssa);
+  assert(ssa.context == BODY_CONTEXT && ssa.environment == ENTRY_ENVIRONMENT);
+
+  CollectAssignments(&ssa, body);
+  Lower(&ssa, body);
+
+  AST_NODE *optimized = NULL;
+  if (!ssa.too_large)
+  {
+    HoistInvariants(&ssa);
+    ReuseValues(&ssa, true);
+    ReuseValues(&ssa, false);
+
+    if (HasReuse(&ssa, 0, ssa.value_count))
+    {
+      size_t cursor = 0;
+      optimized = Rewrite(&ssa, &cursor);
+      if (ssa.slot_count > 0)
+      {
+        AST_NODE *frame = NewASTNode(NODE_FRAME);
+        frame->frame.body = optimized;
+        frame->frame.slot_count = ssa.slot_count;
+        optimized = frame;
+      }
+    }
+  }
+
+  free(ssa.values);
+  free(ssa.keys);
+  free(ssa.operands);
+  free(ssa.region_parents);
+  free(ssa.definitions);
+  free(ssa.assigned);
+  return optimized;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "ast.h"
+
+// Temporaries of a NODE_FRAME, which live on the native stack of every call to an optimized body.
+#define FRAME_MAX_TEMPORARIES 16
+
+// Lowers the body of a lambda taking `params` to SSA form and rewrites it so that values it would
+// evaluate more than once are evaluated once and reused, and values that stay the same across
+// recursive calls are handed down to them. Returns the rewritten body, or NULL if nothing could be
+// removed. What each pass removed is added to the stats.
+AST_NODE *OptimizeBody(AST_NODE *body, FN_PARAM const *params, size_t param_count);
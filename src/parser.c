@@ -4,12 +4,14 @@
 #include <string.h>
 
 #include "parser.h"
+#include "trace.h"
 
 typedef struct
 {
   char const *source;
   TOKEN peeked_token;
   bool has_peeked_token;
+  bool had_error;
 } PARSER_STATE;
 
 static void GetToken(PARSER_STATE *state, TOKEN *token)
@@ -36,6 +38,7 @@ static TOKEN ExpectToken(PARSER_STATE *state, TOKEN_KIND expected_kind)
   {
     fprintf(stderr, "Expected token %s but found token %s.\n", TokenKindName(expected_kind),
             TokenKindName(token.kind));
+    state->had_error = true;
     // If the expected token was not found make one up to try to resume parsing.
     return (TOKEN){.kind = expected_kind, .start = state->source, .len = 0};
   }
@@ -64,89 +67,164 @@ static AST_NODE *ParseConstantNumber(PARSER_STATE *state)
 {
   TOKEN token = ExpectToken(state, TOKEN_NUMBER);
 
-  AST_NODE *node = malloc(sizeof(*node));
-  node->kind = NODE_CONSTANT_NUMBER;
+  AST_NODE *node = NewASTNode(NODE_CONSTANT_NUMBER);
   node->constant_number = strtod(token.start, NULL);
 
-  return node;
+  return InternAST(node);
 }
 
 static AST_NODE *ParseVariable(PARSER_STATE *state)
 {
   TOKEN token = ExpectToken(state, TOKEN_IDENT);
 
-  AST_NODE *node = malloc(sizeof(*node));
-  node->kind = NODE_VARIABLE;
-  node->variable = strndup(token.start, token.len);
+  AST_NODE *node = NewASTNode(NODE_VARIABLE);
+  node->variable = CopyName(token.start, token.len);
 
-  return node;
+  return InternAST(node);
+}
+
+// Lists are collected in a growing buffer and then moved into an exactly sized AST allocation.
+static void *GrowList(void *items, size_t count, size_t *capacity, size_t item_size)
+{
+  if (count < *capacity)
+    return items;
+  *capacity = *capacity ? *capacity * 2 : 8;
+  return realloc(items, *capacity * item_size);
 }
 
-static FN_PARAM *ParseParam(PARSER_STATE *state)
+static void *FinishList(void *items, size_t count, size_t item_size)
+{
+  void *list = AllocAST(item_size * count);
+  if (count > 0)
+    memcpy(list, items, item_size * count);
+  free(items);
+  return list;
+}
+
+static FN_PARAM ParseParam(PARSER_STATE *state)
 {
   TOKEN name = ExpectToken(state, TOKEN_IDENT);
-  FN_PARAM *param = malloc(sizeof(*param));
-  param->name = strndup(name.start, name.len);
-  param->next = NULL;
-  return param;
+  return (FN_PARAM){.name = CopyName(name.start, name.len)};
 }
 
-static FN_PARAM *ParseParams(PARSER_STATE *state)
+static FN_PARAM *ParseParams(PARSER_STATE *state, size_t *count)
 {
-  if (PeekToken(state).kind != TOKEN_IDENT)
-    return NULL;
+  FN_PARAM *params = NULL;
+  size_t capacity = 0;
+  *count = 0;
 
-  FN_PARAM *param = ParseParam(state);
+  if (PeekToken(state).kind == TOKEN_IDENT)
+  {
+    params = GrowList(params, *count, &capacity, sizeof(*params));
+    params[(*count)++] = ParseParam(state);
 
-  while (PeekToken(state).kind == TOKEN_COMMA)
+    while (PeekToken(state).kind == TOKEN_COMMA)
+    {
+      ConsumePeekedToken(state);
+      params = GrowList(params, *count, &capacity, sizeof(*params));
+      params[(*count)++] = ParseParam(state);
+    }
+  }
+
+  return FinishList(params, *count, sizeof(*params));
+}
+
+static bool lazy_parsing;
+
+void SetLazyParsing(bool enabled)
+{
+  lazy_parsing = enabled;
+}
+
+// Skips to the '}' closing a body whose '{' has just been consumed, and returns a node holding the
+// body's source. There are no strings or comments in tan, so every brace counts.
+static AST_NODE *ParseLazyBody(PARSER_STATE *state)
+{
+  char const *start = state->source;
+  char const *end = start;
+  for (size_t depth = 1; *end != '\0'; end++)
   {
-    ConsumePeekedToken(state);
-    FN_PARAM *next_param = ParseParam(state);
-    AppendFnParam(param, next_param);
+    if (*end == '{')
+      depth++;
+    else if (*end == '}' && --depth == 0)
+      break;
   }
+  state->source = end;
 
-  return param;
+  AST_NODE *node = NewASTNode(NODE_LAZY);
+  node->lazy.source = CopySource(start, end - start);
+  atomic_init(&node->lazy.body, NULL);
+  return InternAST(node);
 }
 
 static AST_NODE *ParseLambda(PARSER_STATE *state)
 {
   ExpectToken(state, TOKEN_FN);
   ExpectToken(state, TOKEN_OPAREN);
-  FN_PARAM *params = ParseParams(state);
+  AST_NODE *lambda = NewASTNode(NODE_LAMBDA);
+  lambda->lambda.params = ParseParams(state, &lambda->lambda.param_count);
   ExpectToken(state, TOKEN_CPAREN);
   ExpectToken(state, TOKEN_OBRACE);
-  AST_NODE *lambda = malloc(sizeof(*lambda));
-  lambda->kind = NODE_LAMBDA;
-  lambda->lambda.params = params;
-  lambda->lambda.body = ParseSequence(state);
+  lambda->lambda.body = lazy_parsing ? ParseLazyBody(state) : ParseSequence(state);
   ExpectToken(state, TOKEN_CBRACE);
 
-  return lambda;
+  return InternAST(lambda);
 }
 
-static FN_ARG *ParseArg(PARSER_STATE *state)
+static FN_ARG ParseArg(PARSER_STATE *state)
 {
-  FN_ARG *arg = malloc(sizeof(*arg));
-  arg->value = ParseAssignment(state);
-  arg->next = NULL;
-  return arg;
+  return (FN_ARG){.value = ParseAssignment(state), .spawn = false};
 }
 
-static FN_ARG *ParseArgs(PARSER_STATE *state)
+static FN_ARG *ParseArgs(PARSER_STATE *state, size_t *count)
 {
-  if (PeekToken(state).kind == TOKEN_CPAREN)
-    return NULL;
+  FN_ARG *args = NULL;
+  size_t capacity = 0;
+  *count = 0;
 
-  FN_ARG *arg = ParseArg(state);
+  if (PeekToken(state).kind != TOKEN_CPAREN)
+  {
+    args = GrowList(args, *count, &capacity, sizeof(*args));
+    args[(*count)++] = ParseArg(state);
 
-  while (PeekToken(state).kind == TOKEN_COMMA)
+    while (PeekToken(state).kind == TOKEN_COMMA)
+    {
+      ConsumePeekedToken(state);
+      args = GrowList(args, *count, &capacity, sizeof(*args));
+      args[(*count)++] = ParseArg(state);
+    }
+  }
+
+  return FinishList(args, *count, sizeof(*args));
+}
+
+static AST_NODE *ParseArrayLiteral(PARSER_STATE *state)
+{
+  ExpectToken(state, TOKEN_OBRACKET);
+
+  AST_NODE **items = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+
+  if (PeekToken(state).kind != TOKEN_CBRACKET)
   {
-    ConsumePeekedToken(state);
-    FN_ARG *next_arg = ParseArg(state);
-    AppendFnArg(arg, next_arg);
+    items = GrowList(items, count, &capacity, sizeof(*items));
+    items[count++] = ParseAssignment(state);
+
+    while (PeekToken(state).kind == TOKEN_COMMA)
+    {
+      ConsumePeekedToken(state);
+      items = GrowList(items, count, &capacity, sizeof(*items));
+      items[count++] = ParseAssignment(state);
+    }
   }
 
-  return arg;
+  ExpectToken(state, TOKEN_CBRACKET);
+
+  AST_NODE *array = NewASTNode(NODE_ARRAY);
+  array->array.items = FinishList(items, count, sizeof(*items));
+  array->array.count = count;
+  return InternAST(array);
 }
 
 static AST_NODE *ParseTerm(PARSER_STATE *state)
@@ -162,68 +240,92 @@ static AST_NODE *ParseTerm(PARSER_STATE *state)
     case TOKEN_FN:
       term = ParseLambda(state);
       break;
+    case TOKEN_OBRACKET:
+      term = ParseArrayLiteral(state);
+      break;
     default:
       term = ParseConstantNumber(state);
       break;
   }
 
-  TOKEN oparen = PeekToken(state);
-  while (oparen.kind == TOKEN_OPAREN)
+  // Calls and indexing chain from left to right, as in `f(x)[0]`.
+  TOKEN postfix = PeekToken(state);
+  while (postfix.kind == TOKEN_OPAREN || postfix.kind == TOKEN_OBRACKET)
   {
     ConsumePeekedToken(state);
 
-    AST_NODE *call = malloc(sizeof(*call));
-    call->kind = NODE_CALL;
-    call->call.args = ParseArgs(state);
-    call->call.fn = term;
+    if (postfix.kind == TOKEN_OPAREN)
+    {
+      AST_NODE *call = NewASTNode(NODE_CALL);
+      call->call.args = ParseArgs(state, &call->call.arg_count);
+      call->call.fn = term;
+      call->call.parallel = false;
+      atomic_init(&call->call.site, NULL);
 
-    ExpectToken(state, TOKEN_CPAREN);
+      ExpectToken(state, TOKEN_CPAREN);
+
+      term = InternAST(call);
+    }
+    else
+    {
+      AST_NODE *index = NewASTNode(NODE_INDEX);
+      index->index.array = term;
+      index->index.index = ParseAssignment(state);
+
+      ExpectToken(state, TOKEN_CBRACKET);
 
-    term = call;
+      term = InternAST(index);
+    }
 
-    oparen = PeekToken(state);
+    postfix = PeekToken(state);
   }
 
   return term;
 }
 
-static AST_NODE *ParseFactor(PARSER_STATE *state)
+static AST_NODE *NewBinaryOperation(BINARY_OPERATION_KIND op, AST_NODE *left, AST_NODE *right)
 {
-  AST_NODE *left = ParseTerm(state);
+  AST_NODE *node = NewASTNode(NODE_BINARY_OPERATION);
+  node->binary_operation.left = left;
+  node->binary_operation.right = right;
+  node->binary_operation.op = op;
+  atomic_init(&node->binary_operation.quick, QUICK_UNSEEN);
+  return InternAST(node);
+}
 
-  TOKEN next_token = PeekToken(state);
-  if (next_token.kind == TOKEN_STAR || next_token.kind == TOKEN_SLASH)
+// Binding power of arithmetic operators; 0 for tokens that do not continue an expression.
+static int OperatorPrecedence(TOKEN_KIND kind)
+{
+  switch (kind)
   {
-    ConsumePeekedToken(state);
-
-    AST_NODE *node = malloc(sizeof(*node));
-    node->kind = NODE_BINARY_OPERATION;
-    node->binary_operation.left = left;
-    node->binary_operation.right = ParseFactor(state);
-    node->binary_operation.op = next_token.kind;
-
-    left = node;
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+      return 1;
+    case TOKEN_STAR:
+    case TOKEN_SLASH:
+      return 2;
+    default:
+      return 0;
   }
-
-  return left;
 }
 
-static AST_NODE *ParseSum(PARSER_STATE *state)
+// Precedence climbing: operators of the same precedence are folded into `left` in a loop, which
+// makes them left-associative and keeps the recursion depth at the number of precedence levels.
+static AST_NODE *ParseArithmetic(PARSER_STATE *state, int min_precedence)
 {
-  AST_NODE *left = ParseFactor(state);
+  AST_NODE *left = ParseTerm(state);
 
-  TOKEN next_token = PeekToken(state);
-  if (next_token.kind == TOKEN_PLUS || next_token.kind == TOKEN_MINUS)
+  while (true)
   {
+    TOKEN op = PeekToken(state);
+    int precedence = OperatorPrecedence(op.kind);
+    if (precedence == 0 || precedence < min_precedence)
+      break;
     ConsumePeekedToken(state);
 
-    AST_NODE *node = malloc(sizeof(*node));
-    node->kind = NODE_BINARY_OPERATION;
-    node->binary_operation.left = left;
-    node->binary_operation.right = ParseSum(state);
-    node->binary_operation.op = next_token.kind;
-
-    left = node;
+    // Binary operation kinds share their values with the operator tokens.
+    AST_NODE *right = ParseArithmetic(state, precedence + 1);
+    left = NewBinaryOperation((BINARY_OPERATION_KIND)op.kind, left, right);
   }
 
   return left;
@@ -231,30 +333,29 @@ static AST_NODE *ParseSum(PARSER_STATE *state)
 
 static AST_NODE *ParseAssignment(PARSER_STATE *state)
 {
-  PARSER_STATE saved_state = *state;
+  AST_NODE *target = ParseArithmetic(state, 1);
 
-  TOKEN token = PeekToken(state);
-  if (token.kind == TOKEN_IDENT)
-  {
-    ConsumePeekedToken(state);
-
-    TOKEN equal = PeekToken(state);
-    if (equal.kind != TOKEN_EQUAL)
-    {
-      *state = saved_state;
-      return ParseSum(state);
-    }
-    ConsumePeekedToken(state);
+  if (PeekToken(state).kind != TOKEN_EQUAL)
+    return target;
+  ConsumePeekedToken(state);
 
-    AST_NODE *assignment = malloc(sizeof(*assignment));
-    assignment->kind = NODE_ASSIGNMENT;
-    assignment->assignment.var_name = strndup(token.start, token.len);
-    assignment->assignment.value = ParseSum(state);
+  AST_NODE *value = ParseArithmetic(state, 1);
 
-    return assignment;
+  // Decided only now that '=' has been seen, so the target did not have to be parsed twice.
+  if (target->kind != NODE_VARIABLE)
+  {
+    fprintf(stderr, "Only variables can be assigned to.\n");
+    state->had_error = true;
+    FreeAST(target);
+    return value;
   }
-  else
-    return ParseSum(state);
+
+  AST_NODE *assignment = NewASTNode(NODE_ASSIGNMENT);
+  assignment->assignment.var_name = CopyName(target->variable, strlen(target->variable));
+  assignment->assignment.value = value;
+  FreeAST(target);
+
+  return InternAST(assignment);
 }
 
 static AST_NODE *ParseIfElse(PARSER_STATE *state)
@@ -277,13 +378,12 @@ static AST_NODE *ParseIfElse(PARSER_STATE *state)
     AST_NODE *if_false = ParseIfElse(state);
     ExpectToken(state, TOKEN_CBRACE);
 
-    AST_NODE *if_else = malloc(sizeof(*if_else));
-    if_else->kind = NODE_IF_ELSE;
+    AST_NODE *if_else = NewASTNode(NODE_IF_ELSE);
     if_else->if_else.condition = condition;
     if_else->if_else.if_true = if_true;
     if_else->if_else.if_false = if_false;
 
-    return if_else;
+    return InternAST(if_else);
   }
   else
     return ParseAssignment(state);
@@ -291,34 +391,48 @@ static AST_NODE *ParseIfElse(PARSER_STATE *state)
 
 static AST_NODE *ParseSequence(PARSER_STATE *state)
 {
-  AST_NODE *left = ParseIfElse(state);
+  AST_NODE *first = ParseIfElse(state);
+  if (PeekToken(state).kind != TOKEN_COMMA)
+    return first;
 
-  TOKEN next_token = PeekToken(state);
-  if (next_token.kind == TOKEN_COMMA)
+  AST_NODE **items = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  items = GrowList(items, count, &capacity, sizeof(*items));
+  items[count++] = first;
+
+  while (PeekToken(state).kind == TOKEN_COMMA)
   {
     ConsumePeekedToken(state);
-
-    AST_NODE *node = malloc(sizeof(*node));
-    node->kind = NODE_BINARY_OPERATION;
-    node->binary_operation.left = left;
-    node->binary_operation.right = ParseSequence(state);
-    node->binary_operation.op = BINOP_SEQ;
-
-    left = node;
+    items = GrowList(items, count, &capacity, sizeof(*items));
+    items[count++] = ParseIfElse(state);
   }
 
-  return left;
+  AST_NODE *sequence = NewASTNode(NODE_SEQUENCE);
+  sequence->sequence.items = FinishList(items, count, sizeof(*items));
+  sequence->sequence.count = count;
+  return InternAST(sequence);
 }
 
 AST_NODE *ParseProgram(char const *source)
 {
+  TRACE_BEGIN("parse");
+
   PARSER_STATE state = {
       .source = source,
       .has_peeked_token = false,
+      .had_error = false,
   };
 
   AST_NODE *node = ParseSequence(&state);
   ParseEOF(&state);
 
+  if (state.had_error)
+  {
+    FreeAST(node);
+    node = NULL;
+  }
+
+  TRACE_END("parse");
   return node;
 }
@@ -2,4 +2,8 @@
 
 #include "ast.h"
 
+// Returns NULL if the source has syntax errors, which are reported on stderr.
 AST_NODE *ParseProgram(char const *source);
+// While lazy parsing is enabled, lambda bodies are only brace-matched and become NODE_LAZY nodes;
+// syntax errors in a body are reported when it is first evaluated.
+void SetLazyParsing(bool enabled);
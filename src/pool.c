@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  TASK **tasks;
+  size_t capacity;
+  // Tasks live in [top, bottom), indices taken modulo the capacity.
+  size_t top;
+  size_t bottom;
+} TASK_DEQUE;
+
+struct TASK_POOL
+{
+  size_t worker_count;
+  pthread_t *threads;
+  // One deque per worker plus a shared one for threads outside the pool.
+  TASK_DEQUE *deques;
+  size_t deque_count;
+  atomic_size_t queued;
+  atomic_bool stopping;
+
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle_cond;
+};
+
+// Index of the calling thread's deque in the pool it works for.
+static _Thread_local TASK_POOL *worker_pool;
+static _Thread_local size_t worker_index;
+
+static void InitDeque(TASK_DEQUE *deque)
+{
+  pthread_mutex_init(&deque->lock, NULL);
+  deque->capacity = 64;
+  deque->tasks = malloc(sizeof(TASK *) * deque->capacity);
+  deque->top = 0;
+  deque->bottom = 0;
+}
+
+static void FreeDeque(TASK_DEQUE *deque)
+{
+  pthread_mutex_destroy(&deque->lock);
+  free(deque->tasks);
+}
+
+static void PushBottom(TASK_DEQUE *deque, TASK *task)
+{
+  pthread_mutex_lock(&deque->lock);
+
+  size_t count = deque->bottom - deque->top;
+  if (count == deque->capacity)
+  {
+    TASK **tasks = malloc(sizeof(TASK *) * deque->capacity * 2);
+    for (size_t i = 0; i < count; i++)
+      tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->capacity *= 2;
+    deque->top = 0;
+    deque->bottom = count;
+  }
+  deque->tasks[deque->bottom++ % deque->capacity] = task;
+
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static TASK *PopBottom(TASK_DEQUE *deque)
+{
+  TASK *task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom != deque->top)
+    task = deque->tasks[--deque->bottom % deque->capacity];
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+static TASK *StealTop(TASK_DEQUE *deque)
+{
+  TASK *task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom != deque->top)
+    task = deque->tasks[deque->top++ % deque->capacity];
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+static size_t OwnDequeIndex(TASK_POOL *pool)
+{
+  return worker_pool == pool ? worker_index : pool->worker_count;
+}
+
+static TASK *FindTask(TASK_POOL *pool)
+{
+  size_t own = OwnDequeIndex(pool);
+  TASK *task = PopBottom(&pool->deques[own]);
+
+  for (size_t i = 1; task == NULL && i <= pool->worker_count; i++)
+    task = StealTop(&pool->deques[(own + i) % (pool->worker_count + 1)]);
+
+  if (task != NULL)
+    atomic_fetch_sub(&pool->queued, 1);
+  return task;
+}
+
+static void RunTask(TASK *task)
+{
+  task->run(task);
+  atomic_store_explicit(&task->done, true, memory_order_release);
+}
+
+static void *RunWorker(void *data)
+{
+  TASK_POOL *pool = data;
+
+  while (!atomic_load(&pool->stopping))
+  {
+    TASK *task = FindTask(pool);
+    if (task != NULL)
+    {
+      RunTask(task);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->idle_lock);
+    while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->stopping))
+      pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+    pthread_mutex_unlock(&pool->idle_lock);
+  }
+
+  return NULL;
+}
+
+typedef struct
+{
+  TASK_POOL *pool;
+  size_t index;
+} WORKER_START;
+
+static void *StartWorker(void *data)
+{
+  WORKER_START start = *(WORKER_START *)data;
+  free(data);
+
+  worker_pool = start.pool;
+  worker_index = start.index;
+  return RunWorker(start.pool);
+}
+
+TASK_POOL *NewTaskPool(size_t worker_count)
+{
+  TASK_POOL *pool = malloc(sizeof(*pool));
+  pool->worker_count = worker_count;
+  pool->threads = malloc(sizeof(pthread_t) * worker_count);
+  pool->deque_count = worker_count + 1;
+  pool->deques = malloc(sizeof(TASK_DEQUE) * pool->deque_count);
+  for (size_t i = 0; i < pool->deque_count; i++)
+    InitDeque(&pool->deques[i]);
+  atomic_init(&pool->queued, 0);
+  atomic_init(&pool->stopping, false);
+  pthread_mutex_init(&pool->idle_lock, NULL);
+  pthread_cond_init(&pool->idle_cond, NULL);
+
+  // Workers start with SIGPROF blocked, so that the profiler's handler only ever runs on the
+  // threads that were there before.
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  for (size_t i = 0; i < worker_count; i++)
+  {
+    WORKER_START *start = malloc(sizeof(*start));
+    *start = (WORKER_START){.pool = pool, .index = i};
+    if (pthread_create(&pool->threads[i], NULL, StartWorker, start) != 0)
+    {
+      // Fewer workers only means less parallelism; waiting threads run the tasks themselves.
+      free(start);
+      pool->worker_count = i;
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  return pool;
+}
+
+void FreeTaskPool(TASK_POOL *pool)
+{
+  pthread_mutex_lock(&pool->idle_lock);
+  atomic_store(&pool->stopping, true);
+  pthread_cond_broadcast(&pool->idle_cond);
+  pthread_mutex_unlock(&pool->idle_lock);
+
+  for (size_t i = 0; i < pool->worker_count; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  for (size_t i = 0; i < pool->deque_count; i++)
+    FreeDeque(&pool->deques[i]);
+
+  pthread_mutex_destroy(&pool->idle_lock);
+  pthread_cond_destroy(&pool->idle_cond);
+  free(pool->deques);
+  free(pool->threads);
+  free(pool);
+}
+
+void SubmitTask(TASK_POOL *pool, TASK *task)
+{
+  atomic_init(&task->done, false);
+  // Counted before it is visible so that FindTask never takes the count below zero.
+  atomic_fetch_add(&pool->queued, 1);
+  PushBottom(&pool->deques[OwnDequeIndex(pool)], task);
+
+  pthread_mutex_lock(&pool->idle_lock);
+  pthread_cond_signal(&pool->idle_cond);
+  pthread_mutex_unlock(&pool->idle_lock);
+}
+
+void WaitForTask(TASK_POOL *pool, TASK *task)
+{
+  while (!atomic_load_explicit(&task->done, memory_order_acquire))
+  {
+    TASK *other = FindTask(pool);
+    if (other != NULL)
+      RunTask(other);
+    else
+      sched_yield();
+  }
+}
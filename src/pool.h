@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Work-stealing thread pool. Every worker owns a deque it pushes to and pops from at the bottom;
+// idle workers steal from the top of the other deques. Threads outside the pool submit through a
+// shared deque. Tasks are embedded in caller-owned structs, so the pool never allocates per task.
+typedef struct TASK
+{
+  void (*run)(struct TASK *task);
+  atomic_bool done;
+} TASK;
+
+typedef struct TASK_POOL TASK_POOL;
+
+TASK_POOL *NewTaskPool(size_t worker_count);
+void FreeTaskPool(TASK_POOL *pool);
+void SubmitTask(TASK_POOL *pool, TASK *task);
+// Runs other queued tasks on the calling thread until `task` has finished.
+void WaitForTask(TASK_POOL *pool, TASK *task);
@@ -0,0 +1,299 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "profiler.h"
+
+// Distinct stacks seen between two collections. Must be a power of two.
+#define PROFILER_TABLE_SIZE 4096
+#define PROFILER_FRAME_POOL_SIZE (1 << 16)
+// Distinct frame names seen between two collections, and the bytes their copies may take up. The
+// table size must be a power of two.
+#define PROFILER_NAME_TABLE_SIZE 4096
+#define PROFILER_NAME_POOL_SIZE (1 << 18)
+
+// Stack recorded by the signal handler. The frames live in the frame pool and point to copies of
+// their names in the name pool.
+typedef struct
+{
+  uint64_t hash;
+  size_t first_frame;
+  size_t depth;
+  size_t count;
+} RAW_STACK;
+
+typedef struct
+{
+  char *stack;
+  size_t count;
+} FOLDED_STACK;
+
+static struct
+{
+  INTERPRETER_STATE *volatile state;
+  struct sigaction old_action;
+
+  // Only touched by the signal handler while the timer is running.
+  RAW_STACK raw_stacks[PROFILER_TABLE_SIZE];
+  char const *frame_pool[PROFILER_FRAME_POOL_SIZE];
+  size_t used_frames;
+  // Names on the call stack point into lambda bodies, which may be freed long before the samples
+  // are collected, so the handler keeps copies of them. The name table finds earlier copies.
+  char const *name_table[PROFILER_NAME_TABLE_SIZE];
+  char name_pool[PROFILER_NAME_POOL_SIZE];
+  size_t used_name_bytes;
+  size_t dropped_samples;
+
+  FOLDED_STACK *folded;
+  size_t folded_count;
+  size_t folded_capacity;
+} profiler;
+
+static uint64_t HashFrames(char const *const *frames, size_t depth)
+{
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < depth; i++)
+  {
+    hash ^= (uintptr_t)frames[i];
+    hash *= 1099511628211u;
+  }
+  return hash ^ depth;
+}
+
+static bool SameFrames(char const *const *a, char const *const *b, size_t depth)
+{
+  for (size_t i = 0; i < depth; i++)
+    if (a[i] != b[i])
+      return false;
+  return true;
+}
+
+static bool SameName(char const *a, char const *b)
+{
+  for (; *a == *b; a++, b++)
+    if (*a == '\0')
+      return true;
+  return false;
+}
+
+// Returns the copy of `name` in the name pool, making one if there is none yet, or NULL if the pool
+// is full. Same restrictions as SampleHandler.
+static char const *CopyFrameName(char const *name)
+{
+  uint64_t hash = 14695981039346656037u;
+  size_t len = 0;
+  for (; name[len] != '\0'; len++)
+    hash = (hash ^ (unsigned char)name[len]) * 1099511628211u;
+
+  for (size_t probe = 0; probe < PROFILER_NAME_TABLE_SIZE; probe++)
+  {
+    char const **entry = &profiler.name_table[(hash + probe) & (PROFILER_NAME_TABLE_SIZE - 1)];
+    if (*entry == NULL)
+    {
+      if (profiler.used_name_bytes + len + 1 > PROFILER_NAME_POOL_SIZE)
+        return NULL;
+
+      char *copy = &profiler.name_pool[profiler.used_name_bytes];
+      for (size_t i = 0; i <= len; i++)
+        copy[i] = name[i];
+      profiler.used_name_bytes += len + 1;
+      return *entry = copy;
+    }
+
+    if (SameName(*entry, name))
+      return *entry;
+  }
+
+  return NULL;
+}
+
+// Runs in signal context: no allocation and no library calls, only the preallocated tables.
+static void SampleHandler(int signal)
+{
+  (void)signal;
+
+  INTERPRETER_STATE *state = profiler.state;
+  if (state == NULL)
+    return;
+
+  size_t depth = state->call_stack.depth;
+  atomic_signal_fence(memory_order_acquire);
+  if (depth > CALL_STACK_MAX_FRAMES)
+    depth = CALL_STACK_MAX_FRAMES;
+
+  // Copies are unique per name, so stacks can still be told apart by their frame pointers.
+  char const *frames[CALL_STACK_MAX_FRAMES];
+  for (size_t i = 0; i < depth; i++)
+  {
+    frames[i] = CopyFrameName(state->call_stack.frames[i]);
+    if (frames[i] == NULL)
+    {
+      profiler.dropped_samples++;
+      return;
+    }
+  }
+
+  uint64_t hash = HashFrames(frames, depth);
+  for (size_t probe = 0; probe < PROFILER_TABLE_SIZE; probe++)
+  {
+    RAW_STACK *raw = &profiler.raw_stacks[(hash + probe) & (PROFILER_TABLE_SIZE - 1)];
+    if (raw->count == 0)
+    {
+      if (profiler.used_frames + depth > PROFILER_FRAME_POOL_SIZE)
+        break;
+
+      for (size_t i = 0; i < depth; i++)
+        profiler.frame_pool[profiler.used_frames + i] = frames[i];
+      raw->hash = hash;
+      raw->first_frame = profiler.used_frames;
+      raw->depth = depth;
+      raw->count = 1;
+      profiler.used_frames += depth;
+      return;
+    }
+
+    if (raw->hash == hash && raw->depth == depth &&
+        SameFrames(&profiler.frame_pool[raw->first_frame], frames, depth))
+    {
+      raw->count++;
+      return;
+    }
+  }
+
+  profiler.dropped_samples++;
+}
+
+bool StartProfiler(INTERPRETER_STATE *state, unsigned frequency)
+{
+  if (frequency == 0 || profiler.state != NULL)
+    return false;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = SampleHandler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &profiler.old_action) != 0)
+    return false;
+
+  profiler.state = state;
+
+  long interval_us = 1000000 / frequency;
+  if (interval_us == 0)
+    interval_us = 1;
+  struct itimerval timer = {
+      .it_interval = {.tv_sec = interval_us / 1000000, .tv_usec = interval_us % 1000000},
+      .it_value = {.tv_sec = interval_us / 1000000, .tv_usec = interval_us % 1000000},
+  };
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+  {
+    profiler.state = NULL;
+    sigaction(SIGPROF, &profiler.old_action, NULL);
+    return false;
+  }
+
+  return true;
+}
+
+void StopProfiler(void)
+{
+  if (profiler.state == NULL)
+    return;
+
+  struct itimerval timer = {0};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &profiler.old_action, NULL);
+
+  CollectProfileSamples();
+  profiler.state = NULL;
+}
+
+static void AppendFoldedStack(char *stack, size_t count)
+{
+  if (profiler.folded_count == profiler.folded_capacity)
+  {
+    profiler.folded_capacity = profiler.folded_capacity ? profiler.folded_capacity * 2 : 64;
+    profiler.folded =
+        realloc(profiler.folded, sizeof(*profiler.folded) * profiler.folded_capacity);
+  }
+  profiler.folded[profiler.folded_count++] = (FOLDED_STACK){.stack = stack, .count = count};
+}
+
+static char *FoldFrames(char const *const *frames, size_t depth)
+{
+  static char const root[] = "<toplevel>";
+
+  size_t len = sizeof(root);
+  for (size_t i = 0; i < depth; i++)
+    len += strlen(frames[i]) + 1;
+
+  char *stack = malloc(len);
+  char *end = stpcpy(stack, root);
+  for (size_t i = 0; i < depth; i++)
+  {
+    *end++ = ';';
+    end = stpcpy(end, frames[i]);
+  }
+  return stack;
+}
+
+void CollectProfileSamples(void)
+{
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+
+  for (size_t i = 0; i < PROFILER_TABLE_SIZE; i++)
+  {
+    RAW_STACK *raw = &profiler.raw_stacks[i];
+    if (raw->count == 0)
+      continue;
+
+    AppendFoldedStack(FoldFrames(&profiler.frame_pool[raw->first_frame], raw->depth),
+                      raw->count);
+    raw->count = 0;
+  }
+  profiler.used_frames = 0;
+  memset(profiler.name_table, 0, sizeof(profiler.name_table));
+  profiler.used_name_bytes = 0;
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static int CompareFoldedStacks(void const *a, void const *b)
+{
+  return strcmp(((FOLDED_STACK const *)a)->stack, ((FOLDED_STACK const *)b)->stack);
+}
+
+void WriteFoldedStacks(FILE *file)
+{
+  qsort(profiler.folded, profiler.folded_count, sizeof(*profiler.folded), CompareFoldedStacks);
+
+  for (size_t i = 0; i < profiler.folded_count;)
+  {
+    char const *stack = profiler.folded[i].stack;
+    size_t count = 0;
+    for (; i < profiler.folded_count && strcmp(profiler.folded[i].stack, stack) == 0; i++)
+      count += profiler.folded[i].count;
+    fprintf(file, "%s %zu\n", stack, count);
+  }
+
+  if (profiler.dropped_samples > 0)
+    fprintf(stderr, "Profiler dropped %zu samples.\n", profiler.dropped_samples);
+}
+
+void FreeProfile(void)
+{
+  for (size_t i = 0; i < profiler.folded_count; i++)
+    free(profiler.folded[i].stack);
+  free(profiler.folded);
+
+  profiler.folded = NULL;
+  profiler.folded_count = 0;
+  profiler.folded_capacity = 0;
+  profiler.dropped_samples = 0;
+}
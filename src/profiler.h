@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "interpreter.h"
+
+// Sampling profiler. A SIGPROF timer snapshots the call stack of one interpreter and counts
+// identical stacks; the counts are written in the folded-stack format read by flame graph tools.
+// Task pool and runner workers block SIGPROF, so the handler only interrupts the main thread.
+bool StartProfiler(INTERPRETER_STATE *state, unsigned frequency);
+void StopProfiler(void);
+// Turns the raw samples into owned strings, emptying the fixed-size tables the signal handler
+// records into.
+void CollectProfileSamples(void);
+void WriteFoldedStacks(FILE *file);
+void FreeProfile(void);
@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "interpreter.h"
+#include "runner.h"
+#include "stats.h"
+
+typedef struct
+{
+  bool ok;
+  // Formatted result, or the error message if the script failed.
+  char *output;
+} SCRIPT_RESULT;
+
+typedef struct
+{
+  char const *const *paths;
+  INTERPRETER_STATE const *settings;
+  SCRIPT_RESULT *results;
+  size_t count;
+  atomic_size_t next_script;
+
+  pthread_mutex_t stats_lock;
+  INTERPRETER_STATS stats;
+} RUNNER;
+
+char *ReadFile(char const *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *contents = malloc(size + 1);
+  size_t read = fread(contents, 1, size, file);
+  contents[read] = 0;
+  fclose(file);
+
+  return contents;
+}
+
+size_t DefaultWorkerCount(void)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+static SCRIPT_RESULT RunOneScript(INTERPRETER_STATE *interpreter, char const *path)
+{
+  char *source = ReadFile(path);
+  if (source == NULL)
+    return (SCRIPT_RESULT){.ok = false, .output = strdup("Could not read script.")};
+
+  AST_NODE *ast = ParseProgram(source);
+  free(source);
+  if (ast == NULL)
+    return (SCRIPT_RESULT){.ok = false, .output = strdup("Syntax error.")};
+  if (interpreter->parallel_args_threshold > 0)
+    AnalyzeParallelCalls(ast, interpreter->parallel_args_threshold);
+
+  SCRIPT_RESULT result;
+  VALUE value;
+  if (Evaluate(interpreter, ast, &value))
+  {
+    result = (SCRIPT_RESULT){.ok = true, .output = FormatValue(&value)};
+    ReleaseValue(&value);
+  }
+  else
+    result = (SCRIPT_RESULT){.ok = false, .output = strdup(interpreter->error)};
+
+  FreeAST(ast);
+  return result;
+}
+
+static void *RunWorker(void *data)
+{
+  RUNNER *runner = data;
+
+  size_t index;
+  while ((index = atomic_fetch_add(&runner->next_script, 1)) < runner->count)
+  {
+    // A fresh state per script keeps the scripts independent of each other.
+    INTERPRETER_STATE interpreter = NewInterpreterState(8);
+    CopySettings(&interpreter, runner->settings);
+    runner->results[index] = RunOneScript(&interpreter, runner->paths[index]);
+    FreeInterpreterState(&interpreter);
+  }
+
+  pthread_mutex_lock(&runner->stats_lock);
+  MergeStats(&runner->stats, &stats);
+  pthread_mutex_unlock(&runner->stats_lock);
+
+  return NULL;
+}
+
+bool RunScripts(char const *const *paths, size_t count, size_t workers,
+                INTERPRETER_STATE const *settings)
+{
+  if (workers == 0)
+    workers = 1;
+  if (workers > count)
+    workers = count;
+
+  RUNNER runner = {
+      .paths = paths,
+      .settings = settings,
+      .results = calloc(count, sizeof(SCRIPT_RESULT)),
+      .count = count,
+  };
+  atomic_init(&runner.next_script, 0);
+  pthread_mutex_init(&runner.stats_lock, NULL);
+
+  // Workers start with SIGPROF blocked, like the task pool's.
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  pthread_t *threads = malloc(sizeof(*threads) * workers);
+  size_t started = 0;
+  for (; started < workers; started++)
+    if (pthread_create(&threads[started], NULL, RunWorker, &runner) != 0)
+      break;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  // If no thread could be started the scripts still run, just on this thread.
+  if (started == 0)
+    RunWorker(&runner);
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  if (started > 0)
+    MergeStats(&stats, &runner.stats);
+  pthread_mutex_destroy(&runner.stats_lock);
+
+  bool ok = true;
+  for (size_t i = 0; i < count; i++)
+  {
+    SCRIPT_RESULT *result = &runner.results[i];
+    if (result->ok)
+      printf("%s\t%s\n", paths[i], result->output);
+    else
+      fprintf(stderr, "%s: %s\n", paths[i], result->output);
+    ok = ok && result->ok;
+    free(result->output);
+  }
+  free(runner.results);
+
+  return ok;
+}
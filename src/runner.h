@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "interpreter.h"
+
+char *ReadFile(char const *path);
+// Runs independent scripts on a pool of worker threads, each with its own interpreter state set up
+// like `settings`, and prints their results in the order the scripts were given. Returns false if
+// any script failed.
+bool RunScripts(char const *const *paths, size_t count, size_t workers,
+                INTERPRETER_STATE const *settings);
+size_t DefaultWorkerCount(void);
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "interpreter.h"
+#include "runner.h"
+#include "scheduler.h"
+
+// Virtual size of every script's stack; pages are only committed once the evaluation uses them.
+#define SCRIPT_STACK_SIZE (4 << 20)
+
+typedef struct SCRIPT_TASK
+{
+  struct SCRIPT_TASK *next;
+  char *name;
+  AST_NODE *ast;
+  INTERPRETER_STATE interpreter;
+  ucontext_t context;
+  void *stack;
+  bool finished;
+  bool ok;
+  VALUE result;
+} SCRIPT_TASK;
+
+struct SCHEDULER
+{
+  ucontext_t context;
+  SCRIPT_TASK *current;
+  SCRIPT_TASK *queue_head;
+  SCRIPT_TASK *queue_tail;
+  uint64_t slice_ns;
+  uint64_t slice_start_ns;
+  INTERPRETER_STATE const *settings;
+};
+
+// makecontext can only pass ints to the entry point, so the task to start is found through here.
+static _Thread_local SCHEDULER *running_scheduler;
+
+static uint64_t Now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void Enqueue(SCHEDULER *scheduler, SCRIPT_TASK *task)
+{
+  task->next = NULL;
+  if (scheduler->queue_tail != NULL)
+    scheduler->queue_tail->next = task;
+  else
+    scheduler->queue_head = task;
+  scheduler->queue_tail = task;
+}
+
+static SCRIPT_TASK *Dequeue(SCHEDULER *scheduler)
+{
+  SCRIPT_TASK *task = scheduler->queue_head;
+  if (task != NULL)
+  {
+    scheduler->queue_head = task->next;
+    if (scheduler->queue_head == NULL)
+      scheduler->queue_tail = NULL;
+  }
+  return task;
+}
+
+static void YieldIfSliceUsed(INTERPRETER_STATE *state)
+{
+  SCHEDULER *scheduler = state->yield_context;
+  if (Now() - scheduler->slice_start_ns < scheduler->slice_ns)
+    return;
+
+  swapcontext(&scheduler->current->context, &scheduler->context);
+}
+
+static void RunTaskEntry(void)
+{
+  SCRIPT_TASK *task = running_scheduler->current;
+  task->ok = Evaluate(&task->interpreter, task->ast, &task->result);
+  task->finished = true;
+  // Returning resumes the scheduler through uc_link.
+}
+
+static void *NewStack(void)
+{
+  void *stack = mmap(NULL, SCRIPT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED)
+    return NULL;
+
+  // Guard page, so that running out of stack faults instead of corrupting memory.
+  mprotect(stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+  return stack;
+}
+
+static void FreeTask(SCRIPT_TASK *task)
+{
+  FreeInterpreterState(&task->interpreter);
+  FreeAST(task->ast);
+  munmap(task->stack, SCRIPT_STACK_SIZE);
+  free(task->name);
+  free(task);
+}
+
+SCHEDULER *NewScheduler(uint64_t slice_us, INTERPRETER_STATE const *settings)
+{
+  SCHEDULER *scheduler = calloc(1, sizeof(*scheduler));
+  scheduler->slice_ns = slice_us * 1000;
+  scheduler->settings = settings;
+  return scheduler;
+}
+
+void FreeScheduler(SCHEDULER *scheduler)
+{
+  SCRIPT_TASK *task;
+  while ((task = Dequeue(scheduler)) != NULL)
+    FreeTask(task);
+  free(scheduler);
+}
+
+bool SpawnSource(SCHEDULER *scheduler, char const *name, char const *source)
+{
+  AST_NODE *ast = ParseProgram(source);
+  if (ast == NULL)
+    return false;
+  if (scheduler->settings->parallel_args_threshold > 0)
+    AnalyzeParallelCalls(ast, scheduler->settings->parallel_args_threshold);
+
+  void *stack = NewStack();
+  if (stack == NULL)
+  {
+    FreeAST(ast);
+    return false;
+  }
+
+  SCRIPT_TASK *task = calloc(1, sizeof(*task));
+  task->name = strdup(name);
+  task->ast = ast;
+  task->stack = stack;
+  task->interpreter = NewInterpreterState(8);
+  CopySettings(&task->interpreter, scheduler->settings);
+  task->interpreter.yield = YieldIfSliceUsed;
+  task->interpreter.yield_context = scheduler;
+
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = stack;
+  task->context.uc_stack.ss_size = SCRIPT_STACK_SIZE;
+  task->context.uc_link = &scheduler->context;
+  makecontext(&task->context, RunTaskEntry, 0);
+
+  Enqueue(scheduler, task);
+  return true;
+}
+
+bool SpawnScript(SCHEDULER *scheduler, char const *path)
+{
+  char *source = ReadFile(path);
+  if (source == NULL)
+  {
+    fprintf(stderr, "Could not read script '%s'.\n", path);
+    return false;
+  }
+
+  bool ok = SpawnSource(scheduler, path, source);
+  free(source);
+  return ok;
+}
+
+bool RunScheduler(SCHEDULER *scheduler)
+{
+  SCHEDULER *outer_scheduler = running_scheduler;
+  running_scheduler = scheduler;
+
+  bool ok = true;
+  SCRIPT_TASK *task;
+  while ((task = Dequeue(scheduler)) != NULL)
+  {
+    scheduler->current = task;
+    scheduler->slice_start_ns = Now();
+    swapcontext(&scheduler->context, &task->context);
+    scheduler->current = NULL;
+
+    if (!task->finished)
+    {
+      Enqueue(scheduler, task);
+      continue;
+    }
+
+    if (task->ok)
+    {
+      char *text = FormatValue(&task->result);
+      printf("%s\t%s\n", task->name, text);
+      free(text);
+      ReleaseValue(&task->result);
+    }
+    else
+    {
+      fprintf(stderr, "%s: %s\n", task->name, task->interpreter.error);
+      ok = false;
+    }
+    FreeTask(task);
+  }
+
+  running_scheduler = outer_scheduler;
+  return ok;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "interpreter.h"
+
+// Runs many scripts on the calling thread by giving each one a time slice in turn. Every script
+// evaluates on its own coroutine stack and is switched out from EvaluateCall once its slice is
+// used up, so a long-running script cannot hold up the short ones.
+typedef struct SCHEDULER SCHEDULER;
+
+// Every script gets a state of its own, set up like `settings`.
+SCHEDULER *NewScheduler(uint64_t slice_us, INTERPRETER_STATE const *settings);
+void FreeScheduler(SCHEDULER *scheduler);
+bool SpawnSource(SCHEDULER *scheduler, char const *name, char const *source);
+bool SpawnScript(SCHEDULER *scheduler, char const *path);
+// Runs until every spawned script has finished, printing each result as its script completes.
+// Returns false if any script failed.
+bool RunScheduler(SCHEDULER *scheduler);
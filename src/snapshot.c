@@ -0,0 +1,151 @@
+#include <stdlib.h>
+
+#include "image.h"
+#include "snapshot.h"
+
+// Snapshots are not tied to a particular source, so they all share one key.
+#define SNAPSHOT_KEY 0
+
+typedef struct
+{
+  IMAGE_ROOT *roots;
+  // Lambda values are saved as lambda nodes, built here so they can point at the value's AST, and
+  // arrays as array literals of constants.
+  AST_NODE *nodes;
+  size_t count;
+} SNAPSHOT_WRITER;
+
+static void AddGlobal(VARIABLE *var, void *context)
+{
+  SNAPSHOT_WRITER *writer = context;
+  AST_NODE *node = &writer->nodes[writer->count];
+
+  // Builtins are defined by every interpreter state anyway.
+  if (var->value.kind == VALUE_BUILTIN)
+    return;
+
+  switch (var->value.kind)
+  {
+    case VALUE_NUMBER:
+      node->kind = NODE_CONSTANT_NUMBER;
+      node->constant_number = var->value.number;
+      break;
+    case VALUE_LAMBDA:
+      node->kind = NODE_LAMBDA;
+      node->lambda.params = var->value.lambda->params;
+      node->lambda.param_count = var->value.lambda->param_count;
+      node->lambda.body = var->value.lambda->body;
+      break;
+    case VALUE_ARRAY: {
+      size_t count = var->value.array->count;
+      AST_NODE *items = calloc(count + 1, sizeof(AST_NODE));
+      node->kind = NODE_ARRAY;
+      node->array.items = malloc(sizeof(AST_NODE *) * (count + 1));
+      node->array.count = count;
+      for (size_t i = 0; i < count; i++)
+      {
+        items[i].kind = NODE_CONSTANT_NUMBER;
+        items[i].constant_number = var->value.array->items[i];
+        node->array.items[i] = &items[i];
+      }
+      // The constants are one block, found again through the extra slot when they are freed.
+      node->array.items[count] = items;
+      break;
+    }
+    case VALUE_BUILTIN:
+      break;
+  }
+
+  writer->roots[writer->count++] = (IMAGE_ROOT){.name = var->name, .node = node};
+}
+
+static void CountGlobal(VARIABLE *var, void *context)
+{
+  (void)var;
+  (*(size_t *)context)++;
+}
+
+bool SaveSnapshot(INTERPRETER_STATE *state, char const *path)
+{
+  size_t global_count = 0;
+  ForEachGlobal(state, CountGlobal, &global_count);
+
+  SNAPSHOT_WRITER writer = {
+      .roots = malloc(sizeof(IMAGE_ROOT) * (global_count + 1)),
+      .nodes = calloc(global_count + 1, sizeof(AST_NODE)),
+      .count = 0,
+  };
+  ForEachGlobal(state, AddGlobal, &writer);
+
+  bool ok = WriteImage(path, IMAGE_SNAPSHOT, SNAPSHOT_KEY, writer.roots, writer.count);
+
+  for (size_t i = 0; i < writer.count; i++)
+    if (writer.nodes[i].kind == NODE_ARRAY)
+    {
+      free(writer.nodes[i].array.items[writer.nodes[i].array.count]);
+      free(writer.nodes[i].array.items);
+    }
+  free(writer.roots);
+  free(writer.nodes);
+  return ok;
+}
+
+// Whether `node` is one of the nodes AddGlobal saves values as.
+static bool IsSnapshotValue(AST_NODE *node)
+{
+  switch (node->kind)
+  {
+    case NODE_CONSTANT_NUMBER:
+    case NODE_LAMBDA:
+      return true;
+    case NODE_ARRAY:
+      for (size_t i = 0; i < node->array.count; i++)
+        if (node->array.items[i]->kind != NODE_CONSTANT_NUMBER)
+          return false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool LoadSnapshot(INTERPRETER_STATE *state, char const *path)
+{
+  size_t count;
+  IMAGE_ROOT *roots = ReadImage(path, IMAGE_SNAPSHOT, SNAPSHOT_KEY, &count);
+  if (roots == NULL)
+    return false;
+
+  bool ok = true;
+  for (size_t i = 0; i < count; i++)
+  {
+    AST_NODE *node = roots[i].node;
+    if (roots[i].name == NULL || !IsSnapshotValue(node))
+    {
+      FreeAST(node);
+      ok = false;
+      continue;
+    }
+
+    VALUE value;
+    switch (node->kind)
+    {
+      case NODE_CONSTANT_NUMBER:
+        value = ValueNumber(node->constant_number);
+        break;
+      case NODE_LAMBDA:
+        value = ValueLambda(node->lambda.params, node->lambda.param_count, node->lambda.body);
+        break;
+      default:
+        value = ValueArray(NewArray(node->array.count));
+        for (size_t j = 0; j < node->array.count; j++)
+          value.array->items[j] = node->array.items[j]->constant_number;
+        break;
+    }
+    FreeAST(node);
+
+    DefineGlobal(state, roots[i].name, value);
+  }
+
+  FreeImageRoots(roots, count);
+  return ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "interpreter.h"
+
+// Snapshots of an interpreter's global variables. Restoring one defines the saved globals in a
+// state without parsing or evaluating the code that created them.
+bool SaveSnapshot(INTERPRETER_STATE *state, char const *path);
+bool LoadSnapshot(INTERPRETER_STATE *state, char const *path);
@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "stats.h"
+
+_Thread_local INTERPRETER_STATS stats;
+
+static char const *MemoryKindName(STATS_MEMORY_KIND kind)
+{
+  switch (kind)
+  {
+    case STATS_MEMORY_AST:
+      return "ast";
+    case STATS_MEMORY_SCOPES:
+      return "scopes";
+    case STATS_MEMORY_NAMES:
+      return "names";
+    case STATS_MEMORY_COMPACT_AST:
+      return "compact ast";
+    case STATS_MEMORY_ARRAYS:
+      return "arrays";
+    case STATS_MEMORY_KIND_COUNT:
+      break;
+  }
+
+  return "<unknown>";
+}
+
+void PrintStats(FILE *file)
+{
+  fprintf(file, "evaluations:\n");
+  for (size_t kind = 0; kind < AST_NODE_KIND_COUNT; kind++)
+    fprintf(file, "  %-22s %zu\n", ASTNodeKindName(kind), stats.evaluations[kind]);
+
+  fprintf(file, "%-24s %zu\n", "scopes pushed:", stats.scopes_pushed);
+  fprintf(file, "%-24s %zu\n", "scopes popped:", stats.scopes_popped);
+  fprintf(file, "%-24s %zu\n", "builtin calls:", stats.builtin_calls);
+  fprintf(file, "%-24s %zu\n", "calls inlined:", stats.calls_inlined);
+  fprintf(file, "%-24s %zu\n", "leaf calls:", stats.leaf_calls);
+  fprintf(file, "%-24s %zu\n", "arithmetic deopts:", stats.arithmetic_deopts);
+  fprintf(file, "%-24s %zu\n", "expressions reused:", stats.expressions_reused);
+  fprintf(file, "%-24s %zu\n", "calls reused:", stats.calls_reused);
+  fprintf(file, "%-24s %zu\n", "invariants hoisted:", stats.invariants_hoisted);
+  fprintf(file, "%-24s %zu\n", "variable gets:", stats.variable_gets);
+  fprintf(file, "%-24s %zu\n", "variable sets:", stats.variable_sets);
+  fprintf(file, "%-24s %zu\n", "variable slots scanned:", stats.variable_slots_scanned);
+  fprintf(file, "%-24s %zu\n", "ast nodes copied:", stats.ast_nodes_copied);
+  fprintf(file, "%-24s %zu\n", "ast nodes shared:", stats.ast_nodes_shared);
+
+  fprintf(file, "bytes allocated:\n");
+  for (size_t kind = 0; kind < STATS_MEMORY_KIND_COUNT; kind++)
+    fprintf(file, "  %-22s %zu\n", MemoryKindName(kind), stats.bytes_allocated[kind]);
+}
+
+void ResetStats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void MergeStats(INTERPRETER_STATS *into, INTERPRETER_STATS const *from)
+{
+  for (size_t kind = 0; kind < AST_NODE_KIND_COUNT; kind++)
+    into->evaluations[kind] += from->evaluations[kind];
+  into->scopes_pushed += from->scopes_pushed;
+  into->scopes_popped += from->scopes_popped;
+  into->builtin_calls += from->builtin_calls;
+  into->calls_inlined += from->calls_inlined;
+  into->leaf_calls += from->leaf_calls;
+  into->arithmetic_deopts += from->arithmetic_deopts;
+  into->expressions_reused += from->expressions_reused;
+  into->calls_reused += from->calls_reused;
+  into->invariants_hoisted += from->invariants_hoisted;
+  into->variable_gets += from->variable_gets;
+  into->variable_sets += from->variable_sets;
+  into->variable_slots_scanned += from->variable_slots_scanned;
+  into->ast_nodes_copied += from->ast_nodes_copied;
+  into->ast_nodes_shared += from->ast_nodes_shared;
+  for (size_t kind = 0; kind < STATS_MEMORY_KIND_COUNT; kind++)
+    into->bytes_allocated[kind] += from->bytes_allocated[kind];
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "ast.h"
+
+typedef enum
+{
+  STATS_MEMORY_AST,
+  STATS_MEMORY_SCOPES,
+  STATS_MEMORY_NAMES,
+  STATS_MEMORY_COMPACT_AST,
+  STATS_MEMORY_ARRAYS,
+  STATS_MEMORY_KIND_COUNT,
+} STATS_MEMORY_KIND;
+
+// Counters of the interpreter's hot paths. They are plain increments on a thread-local struct so
+// they can stay enabled all the time.
+typedef struct
+{
+  size_t evaluations[AST_NODE_KIND_COUNT];
+  size_t scopes_pushed;
+  size_t scopes_popped;
+  size_t builtin_calls;
+  size_t calls_inlined;
+  size_t leaf_calls;
+  size_t arithmetic_deopts;
+  // Evaluations that bodies rewritten by OptimizeBody skipped, counted as they run: loads of reused
+  // values, and invariants already held by their own frame or the recursive caller's. Values the
+  // rewrite replaced by constants are not counted.
+  size_t expressions_reused;
+  size_t calls_reused;
+  size_t invariants_hoisted;
+  size_t variable_gets;
+  size_t variable_sets;
+  size_t variable_slots_scanned;
+  size_t ast_nodes_copied;
+  size_t ast_nodes_shared;
+  size_t bytes_allocated[STATS_MEMORY_KIND_COUNT];
+} INTERPRETER_STATS;
+
+extern _Thread_local INTERPRETER_STATS stats;
+
+#define COUNT_ALLOCATION(memory_kind, size) (stats.bytes_allocated[(memory_kind)] += (size))
+
+void PrintStats(FILE *file);
+void ResetStats(void);
+void MergeStats(INTERPRETER_STATS *into, INTERPRETER_STATS const *from);
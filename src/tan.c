@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "tan.h"
+
+struct TAN_CONTEXT
+{
+  INTERPRETER_STATE interpreter;
+};
+
+struct TAN_PROGRAM
+{
+  AST_NODE *ast;
+};
+
+TAN_CONTEXT *TanNewContext(size_t workers)
+{
+  TAN_CONTEXT *context = malloc(sizeof(*context));
+  context->interpreter = NewInterpreterState(8);
+  if (workers > 0)
+    context->interpreter.pool = NewTaskPool(workers);
+  return context;
+}
+
+void TanFreeContext(TAN_CONTEXT *context)
+{
+  if (context->interpreter.pool != NULL)
+    FreeTaskPool(context->interpreter.pool);
+  FreeInterpreterState(&context->interpreter);
+  free(context);
+}
+
+void TanSetLimits(TAN_CONTEXT *context, size_t fuel_limit, size_t memory_limit)
+{
+  context->interpreter.fuel_limit = fuel_limit;
+  context->interpreter.memory_limit = memory_limit;
+}
+
+TAN_PROGRAM *TanCompile(char const *source)
+{
+  AST_NODE *ast = ParseProgram(source);
+  if (ast == NULL)
+    return NULL;
+
+  TAN_PROGRAM *program = malloc(sizeof(*program));
+  program->ast = ast;
+  return program;
+}
+
+void TanFreeProgram(TAN_PROGRAM *program)
+{
+  FreeAST(program->ast);
+  free(program);
+}
+
+bool TanEvaluate(TAN_CONTEXT *context, TAN_PROGRAM const *program, double *result)
+{
+  INTERPRETER_STATE *interpreter = &context->interpreter;
+
+  VALUE value;
+  if (!Evaluate(interpreter, program->ast, &value))
+    return false;
+
+  if (value.kind != VALUE_NUMBER)
+  {
+    ReleaseValue(&value);
+    snprintf(interpreter->error, sizeof(interpreter->error), "The result is not a number.");
+    return false;
+  }
+
+  *result = value.number;
+  return true;
+}
+
+char const *TanError(TAN_CONTEXT const *context)
+{
+  return context->interpreter.error;
+}
+
+void TanSetNumber(TAN_CONTEXT *context, char const *name, double value)
+{
+  DefineGlobal(&context->interpreter, name, ValueNumber(value));
+}
+
+bool TanGetNumber(TAN_CONTEXT *context, char const *name, double *value)
+{
+  VALUE const *global = FindGlobal(&context->interpreter, name);
+  if (global == NULL || global->kind != VALUE_NUMBER)
+    return false;
+
+  *value = global->number;
+  return true;
+}
+
+typedef struct
+{
+  BUILTIN builtin;
+  TAN_FUNCTION *function;
+  void *data;
+} TAN_REGISTERED_FUNCTION;
+
+static VALUE CallRegisteredFunction(INTERPRETER_STATE *state, VALUE *args, void *data)
+{
+  TAN_REGISTERED_FUNCTION const *registered = data;
+
+  double numbers[BUILTIN_MAX_PARAMS];
+  for (size_t i = 0; i < registered->builtin.param_count; i++)
+  {
+    if (args[i].kind != VALUE_NUMBER)
+      RuntimeError(state, "%s: expected a number.", registered->builtin.name);
+    numbers[i] = args[i].number;
+  }
+  return ValueNumber(registered->function(numbers, registered->data));
+}
+
+bool TanRegisterFunction(char const *name, size_t param_count, TAN_FUNCTION *function,
+                         void *data)
+{
+  if (param_count > BUILTIN_MAX_PARAMS)
+    return false;
+
+  // Builtins stay registered for the rest of the process.
+  TAN_REGISTERED_FUNCTION *registered = malloc(sizeof(*registered));
+  *registered = (TAN_REGISTERED_FUNCTION){
+      .builtin = {.name = strdup(name), .param_count = param_count,
+                  .call = CallRegisteredFunction, .data = registered},
+      .function = function,
+      .data = data,
+  };
+  return RegisterBuiltin(&registered->builtin);
+}
+
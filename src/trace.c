@@ -0,0 +1,135 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_NAME_LEN 31
+
+typedef struct
+{
+  uint64_t timestamp_ns;
+  char phase;
+  char name[TRACE_NAME_LEN];
+} TRACE_EVENT;
+
+typedef struct TRACE_BUFFER
+{
+  struct TRACE_BUFFER *next;
+  size_t thread_id;
+  size_t capacity;
+  // Total number of events recorded; the buffer keeps the last `capacity` of them.
+  _Atomic size_t recorded;
+  TRACE_EVENT events[];
+} TRACE_BUFFER;
+
+_Atomic bool tracing_enabled = false;
+
+static size_t trace_capacity;
+static _Atomic(TRACE_BUFFER *) trace_buffers;
+static atomic_size_t trace_thread_count;
+static _Thread_local TRACE_BUFFER *thread_buffer;
+
+static uint64_t TraceTimestamp(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static TRACE_BUFFER *RegisterThreadBuffer(void)
+{
+  TRACE_BUFFER *buffer = malloc(sizeof(*buffer) + sizeof(TRACE_EVENT) * trace_capacity);
+  buffer->thread_id = atomic_fetch_add(&trace_thread_count, 1);
+  buffer->capacity = trace_capacity;
+  atomic_init(&buffer->recorded, 0);
+
+  buffer->next = atomic_load(&trace_buffers);
+  while (!atomic_compare_exchange_weak(&trace_buffers, &buffer->next, buffer))
+    ;
+
+  return buffer;
+}
+
+void StartTracing(size_t events_per_thread)
+{
+  trace_capacity = events_per_thread > 0 ? events_per_thread : 1;
+  atomic_store(&tracing_enabled, true);
+}
+
+void StopTracing(void)
+{
+  atomic_store(&tracing_enabled, false);
+}
+
+void TraceEvent(char phase, char const *name)
+{
+  TRACE_BUFFER *buffer = thread_buffer;
+  if (buffer == NULL)
+    buffer = thread_buffer = RegisterThreadBuffer();
+
+  size_t recorded = atomic_load_explicit(&buffer->recorded, memory_order_relaxed);
+  TRACE_EVENT *event = &buffer->events[recorded % buffer->capacity];
+  event->timestamp_ns = TraceTimestamp();
+  event->phase = phase;
+  strncpy(event->name, name, TRACE_NAME_LEN - 1);
+  event->name[TRACE_NAME_LEN - 1] = 0;
+
+  atomic_store_explicit(&buffer->recorded, recorded + 1, memory_order_release);
+}
+
+static void WriteEvent(FILE *file, TRACE_EVENT *event, size_t thread_id, uint64_t start_ns,
+                       bool first)
+{
+  fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu}",
+          first ? "" : ",", event->name, event->phase,
+          (event->timestamp_ns - start_ns) / 1000.0, thread_id);
+}
+
+void WriteChromeTrace(FILE *file)
+{
+  uint64_t start_ns = UINT64_MAX;
+  for (TRACE_BUFFER *buffer = atomic_load(&trace_buffers); buffer != NULL; buffer = buffer->next)
+  {
+    size_t recorded = atomic_load_explicit(&buffer->recorded, memory_order_acquire);
+    size_t first = recorded > buffer->capacity ? recorded - buffer->capacity : 0;
+    if (first < recorded && buffer->events[first % buffer->capacity].timestamp_ns < start_ns)
+      start_ns = buffer->events[first % buffer->capacity].timestamp_ns;
+  }
+
+  bool first_event = true;
+  fprintf(file, "{\"traceEvents\":[");
+  for (TRACE_BUFFER *buffer = atomic_load(&trace_buffers); buffer != NULL; buffer = buffer->next)
+  {
+    size_t recorded = atomic_load_explicit(&buffer->recorded, memory_order_acquire);
+    size_t first = recorded > buffer->capacity ? recorded - buffer->capacity : 0;
+    // Once the ring has wrapped it starts in the middle of the stack, with end events whose begin
+    // events were overwritten. Viewers cannot pair those, so they are left out.
+    size_t depth = 0;
+    for (size_t i = first; i < recorded; i++)
+    {
+      TRACE_EVENT *event = &buffer->events[i % buffer->capacity];
+      if (event->phase == 'E' && depth == 0)
+        continue;
+      depth += event->phase == 'B' ? 1 : -1;
+
+      WriteEvent(file, event, buffer->thread_id, start_ns, first_event);
+      first_event = false;
+    }
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+void FreeTrace(void)
+{
+  TRACE_BUFFER *buffer = atomic_exchange(&trace_buffers, NULL);
+  while (buffer != NULL)
+  {
+    TRACE_BUFFER *next = buffer->next;
+    free(buffer);
+    buffer = next;
+  }
+  thread_buffer = NULL;
+}
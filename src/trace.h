@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Event tracer. Each thread records begin/end events into its own ring buffer, which only that
+// thread writes to; the buffers are flushed as Chrome trace-event JSON. While tracing is off every
+// hook is a single branch on tracing_enabled, which is read with relaxed loads as every thread
+// checks it while StopTracing may clear it.
+extern _Atomic bool tracing_enabled;
+
+#define TRACING_ENABLED()                                                                          \
+  __builtin_expect(atomic_load_explicit(&tracing_enabled, memory_order_relaxed), 0)
+
+#define TRACE_BEGIN(name)                                                                          \
+  do                                                                                               \
+  {                                                                                                \
+    if (TRACING_ENABLED())                                                                         \
+      TraceEvent('B', (name));                                                                     \
+  }                                                                                                \
+  while (false)
+
+#define TRACE_END(name)                                                                            \
+  do                                                                                               \
+  {                                                                                                \
+    if (TRACING_ENABLED())                                                                         \
+      TraceEvent('E', (name));                                                                     \
+  }                                                                                                \
+  while (false)
+
+void StartTracing(size_t events_per_thread);
+void StopTracing(void);
+void TraceEvent(char phase, char const *name);
+void WriteChromeTrace(FILE *file);
+void FreeTrace(void);
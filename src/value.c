@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ast.h"
 #include "value.h"
@@ -9,62 +11,168 @@ VALUE ValueNumber(double number)
   return (VALUE){.kind = VALUE_NUMBER, .number = number};
 }
 
-VALUE ValueLambda(FN_PARAM *params, AST_NODE *body)
+static atomic_uint_least64_t next_lambda_id = 1;
+
+VALUE ValueLambda(FN_PARAM *params, size_t param_count, AST_NODE *body)
 {
-  LAMBDA lambda = (LAMBDA){.params = CopyFnParams(params), .body = CopyAST(body)};
+  LAMBDA *lambda = AllocAST(sizeof(*lambda));
+  atomic_init(&lambda->refs, 1);
+  lambda->id = atomic_fetch_add_explicit(&next_lambda_id, 1, memory_order_relaxed);
+  lambda->params = CopyFnParams(params, param_count);
+  lambda->param_count = param_count;
+  lambda->body = CopyAST(body);
+  atomic_init(&lambda->leaf, LEAF_UNKNOWN);
+  atomic_init(&lambda->code, NULL);
   return (VALUE){.kind = VALUE_LAMBDA, .lambda = lambda};
 }
 
-void FreeValue(VALUE *value)
+VALUE ValueArray(ARRAY *array)
 {
-  switch (value->kind)
+  return (VALUE){.kind = VALUE_ARRAY, .array = array};
+}
+
+VALUE ValueBuiltin(BUILTIN const *builtin)
+{
+  return (VALUE){.kind = VALUE_BUILTIN, .builtin = builtin};
+}
+
+VALUE RetainValue(VALUE value)
+{
+  switch (value.kind)
   {
     case VALUE_NUMBER:
+    case VALUE_BUILTIN:
       break;
     case VALUE_LAMBDA:
-      FreeAST(value->lambda.body);
+      atomic_fetch_add_explicit(&value.lambda->refs, 1, memory_order_relaxed);
+      break;
+    case VALUE_ARRAY:
+      RetainArray(value.array);
       break;
   }
+  return value;
+}
+
+void ReleaseValue(VALUE *value)
+{
+  switch (value->kind)
+  {
+    case VALUE_NUMBER:
+    case VALUE_BUILTIN:
+      break;
+    case VALUE_LAMBDA: {
+      LAMBDA *lambda = value->lambda;
+      if (atomic_fetch_sub_explicit(&lambda->refs, 1, memory_order_acq_rel) == 1)
+      {
+        FreeFnParams(lambda->params, lambda->param_count);
+        AST_NODE *code = atomic_load_explicit(&lambda->code, memory_order_relaxed);
+        if (code != NULL && code != lambda->body)
+          FreeAST(code);
+        FreeAST(lambda->body);
+        free(lambda);
+      }
+      break;
+    }
+    case VALUE_ARRAY:
+      ReleaseArray(value->array);
+      break;
+  }
+}
+
+static VALUE ArrayOperation(BINARY_OPERATION_KIND op, VALUE left, VALUE right)
+{
+  assert((left.kind != VALUE_ARRAY || right.kind != VALUE_ARRAY ||
+          left.array->count == right.array->count) &&
+         "ArrayOperation: arrays must have the same length");
+  return ValueArray(ArrayArithmetic(op, left.kind == VALUE_ARRAY ? left.array : NULL, left.number,
+                                    right.kind == VALUE_ARRAY ? right.array : NULL, right.number));
 }
 
 VALUE
 ValueAdd(VALUE left, VALUE right)
 {
-  assert(left.kind == VALUE_NUMBER && right.kind == VALUE_NUMBER &&
-         "ValueAdd: only numbers can be added");
+  assert((left.kind == VALUE_NUMBER || left.kind == VALUE_ARRAY) &&
+         (right.kind == VALUE_NUMBER || right.kind == VALUE_ARRAY) &&
+         "ValueAdd: only numbers and arrays can be added");
+  if (left.kind == VALUE_ARRAY || right.kind == VALUE_ARRAY)
+    return ArrayOperation(BINOP_ADD, left, right);
   return ValueNumber(left.number + right.number);
 }
 
 VALUE ValueSub(VALUE left, VALUE right)
 {
-  assert(left.kind == VALUE_NUMBER && right.kind == VALUE_NUMBER &&
-         "ValueSub: only numbers can be subtracted");
+  assert((left.kind == VALUE_NUMBER || left.kind == VALUE_ARRAY) &&
+         (right.kind == VALUE_NUMBER || right.kind == VALUE_ARRAY) &&
+         "ValueSub: only numbers and arrays can be subtracted");
+  if (left.kind == VALUE_ARRAY || right.kind == VALUE_ARRAY)
+    return ArrayOperation(BINOP_SUB, left, right);
   return ValueNumber(left.number - right.number);
 }
 
 VALUE ValueMul(VALUE left, VALUE right)
 {
-  assert(left.kind == VALUE_NUMBER && right.kind == VALUE_NUMBER &&
-         "ValueMul: only numbers can be multiplied");
+  assert((left.kind == VALUE_NUMBER || left.kind == VALUE_ARRAY) &&
+         (right.kind == VALUE_NUMBER || right.kind == VALUE_ARRAY) &&
+         "ValueMul: only numbers and arrays can be multiplied");
+  if (left.kind == VALUE_ARRAY || right.kind == VALUE_ARRAY)
+    return ArrayOperation(BINOP_MUL, left, right);
   return ValueNumber(left.number * right.number);
 }
 
 VALUE ValueDiv(VALUE left, VALUE right)
 {
-  assert(left.kind == VALUE_NUMBER && right.kind == VALUE_NUMBER &&
-         "ValueDiv: only numbers can be divided");
+  assert((left.kind == VALUE_NUMBER || left.kind == VALUE_ARRAY) &&
+         (right.kind == VALUE_NUMBER || right.kind == VALUE_ARRAY) &&
+         "ValueDiv: only numbers and arrays can be divided");
+  if (left.kind == VALUE_ARRAY || right.kind == VALUE_ARRAY)
+    return ArrayOperation(BINOP_DIV, left, right);
   return ValueNumber(left.number / right.number);
 }
 
-void PrintValue(VALUE *value)
+char *FormatValue(VALUE *value)
 {
   switch (value->kind)
   {
-    case VALUE_NUMBER:
-      printf("%f", value->number);
-      break;
+    case VALUE_NUMBER: {
+      int len = snprintf(NULL, 0, "%f", value->number);
+      char *text = malloc(len + 1);
+      snprintf(text, len + 1, "%f", value->number);
+      return text;
+    }
     case VALUE_LAMBDA:
-      printf("<lambda>");
-      break;
+      return strdup("<lambda>");
+    case VALUE_BUILTIN: {
+      int len = snprintf(NULL, 0, "<builtin %s>", value->builtin->name);
+      char *text = malloc(len + 1);
+      snprintf(text, len + 1, "<builtin %s>", value->builtin->name);
+      return text;
+    }
+    case VALUE_ARRAY: {
+      size_t capacity = 64;
+      size_t len = 0;
+      char *text = malloc(capacity);
+      text[len++] = '[';
+      for (size_t i = 0; i < value->array->count; i++)
+      {
+        // Room for the separator, the item and the closing bracket.
+        int item_len = snprintf(NULL, 0, "%f", value->array->items[i]);
+        while (len + item_len + 4 > capacity)
+          text = realloc(text, capacity *= 2);
+        len += sprintf(text + len, i == 0 ? "%f" : ", %f", value->array->items[i]);
+      }
+      text[len++] = ']';
+      text[len] = '\0';
+      return text;
+    }
   }
+
+  assert(!"FormatValue: unreachable");
+  return NULL;
+}
+
+void PrintValue(VALUE *value)
+{
+  char *text = FormatValue(value);
+  fputs(text, stdout);
+  free(text);
 }
@@ -1,34 +1,82 @@
 #pragma once
 
+#include "array.h"
 #include "parser.h"
 
+typedef enum
+{
+  LEAF_UNKNOWN,
+  LEAF_YES,
+  LEAF_NO,
+} LEAF_KIND;
+
+// Lambdas and arrays are shared by reference counting, so values can be copied freely as long as
+// each copy that is kept is retained.
 typedef struct
 {
+  atomic_size_t refs;
+  // Unique for the lifetime of the process, unlike the address of the lambda, which a new lambda
+  // may reuse once this one is freed.
+  uint64_t id;
   FN_PARAM *params;
+  size_t param_count;
   AST_NODE *body;
+  // Whether calls can keep the parameters on the native stack instead of in a scope, worked out by
+  // the first call that finds the body parsed.
+  _Atomic LEAF_KIND leaf;
+  // What calls evaluate: `body` itself or, once worked out by a call with optimization enabled,
+  // the body as rewritten by OptimizeBody. Snapshots and the analyses keep to `body`.
+  AST_NODE *_Atomic code;
 } LAMBDA;
 
+typedef struct BUILTIN BUILTIN;
+
 typedef enum
 {
   VALUE_NUMBER,
   VALUE_LAMBDA,
+  VALUE_ARRAY,
+  VALUE_BUILTIN,
 } VALUE_KIND;
 
-typedef struct
+typedef struct VALUE
 {
   VALUE_KIND kind;
   union
   {
     double number;
-    LAMBDA lambda;
+    LAMBDA *lambda;
+    ARRAY *array;
+    BUILTIN const *builtin;
   };
 } VALUE;
 
+struct INTERPRETER_STATE;
+
+#define BUILTIN_MAX_PARAMS 4
+
+// A function implemented in C. It is called with `param_count` arguments, which stay owned by the
+// caller, and `data`, and returns a value the caller owns.
+struct BUILTIN
+{
+  char const *name;
+  size_t param_count;
+  VALUE (*call)(struct INTERPRETER_STATE *state, VALUE *args, void *data);
+  void *data;
+};
+
 VALUE ValueNumber(double number);
-VALUE ValueLambda(FN_PARAM *params, AST_NODE *body);
-void FreeValue(VALUE *value);
+VALUE ValueLambda(FN_PARAM *params, size_t param_count, AST_NODE *body);
+// Takes over the caller's reference to `array`.
+VALUE ValueArray(ARRAY *array);
+VALUE ValueBuiltin(BUILTIN const *builtin);
+VALUE RetainValue(VALUE value);
+void ReleaseValue(VALUE *value);
+// Numbers and arrays can be mixed freely, with numbers broadcast over every item of the other
+// operand; two arrays must have the same length.
 VALUE ValueAdd(VALUE left, VALUE right);
 VALUE ValueSub(VALUE left, VALUE right);
 VALUE ValueMul(VALUE left, VALUE right);
 VALUE ValueDiv(VALUE left, VALUE right);
+char *FormatValue(VALUE *value);
 void PrintValue(VALUE *value);
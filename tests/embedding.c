@@ -0,0 +1,67 @@
+// Embeds tan through tan.h alone: registers a C function, calls it from a program and reads the
+// result and the error back. Failing evaluations leave nothing behind in the context, which leak
+// checking builds verify.
+#include <stdio.h>
+#include <string.h>
+
+#include "tan.h"
+
+static double ScaledSumOfSquares(double const *args, void *data)
+{
+  return (args[0] * args[0] + args[1] * args[1]) * *(double const *)data;
+}
+
+int main(void)
+{
+  double scale = 2;
+  if (!TanRegisterFunction("squares", 2, ScaledSumOfSquares, &scale) ||
+      TanRegisterFunction("too_many", 5, ScaledSumOfSquares, &scale))
+  {
+    fprintf(stderr, "Registering functions failed.\n");
+    return 1;
+  }
+
+  TAN_CONTEXT *context = TanNewContext(0);
+  TAN_PROGRAM *call = TanCompile("f = fn(x) { squares(x, y) }, f(3) + sqrt(16)");
+  TAN_PROGRAM *misuse = TanCompile("squares([1], 2)");
+  // Each fails after an array has been evaluated and before it is used.
+  char const *failing_sources[] = {
+      "a = [1, 2, 3], a + q",
+      "a = [1, 2, 3], a[q]",
+      "[1, 2, q]",
+      "g = fn(a) { a + q }, g([1, 2, 3])",
+      "[1, 2] + squares(1, q)",
+  };
+  size_t failing_count = sizeof(failing_sources) / sizeof(failing_sources[0]);
+
+  bool ok = true;
+  double result = 0;
+  TanSetNumber(context, "y", 4);
+  if (!TanEvaluate(context, call, &result) || result != 54)
+  {
+    fprintf(stderr, "Expected 54, got %f (%s).\n", result, TanError(context));
+    ok = false;
+  }
+  if (TanEvaluate(context, misuse, &result) ||
+      strcmp(TanError(context), "squares: expected a number.") != 0)
+  {
+    fprintf(stderr, "Expected an error for array arguments.\n");
+    ok = false;
+  }
+  for (size_t i = 0; i < failing_count; i++)
+  {
+    TAN_PROGRAM *failing = TanCompile(failing_sources[i]);
+    if (TanEvaluate(context, failing, &result) ||
+        strcmp(TanError(context), "Unknown variable 'q'.") != 0)
+    {
+      fprintf(stderr, "Expected '%s' to fail on q.\n", failing_sources[i]);
+      ok = false;
+    }
+    TanFreeProgram(failing);
+  }
+
+  TanFreeProgram(misuse);
+  TanFreeProgram(call);
+  TanFreeContext(context);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// Evaluates programs on several interpreter states at once, one per thread, and checks that every
+// state only ever sees its own globals, results and errors.
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "interpreter.h"
+#include "parser.h"
+
+#define THREAD_COUNT 8
+#define ROUNDS 200
+
+typedef struct
+{
+  size_t index;
+  bool ok;
+  char failure[2 * INTERPRETER_ERROR_LEN];
+} THREAD;
+
+static AST_NODE *ParseFormatted(char const *format, size_t index)
+{
+  char source[256];
+  snprintf(source, sizeof(source), format, index);
+  return ParseProgram(source);
+}
+
+static bool ExpectNumber(THREAD *thread, INTERPRETER_STATE *state, AST_NODE *ast, double expected)
+{
+  VALUE value;
+  if (!Evaluate(state, ast, &value))
+  {
+    snprintf(thread->failure, sizeof(thread->failure), "unexpected error: %s", state->error);
+    return false;
+  }
+
+  bool ok = value.kind == VALUE_NUMBER && value.number == expected;
+  if (!ok)
+    snprintf(thread->failure, sizeof(thread->failure), "expected %f", expected);
+  ReleaseValue(&value);
+  return ok;
+}
+
+static bool ExpectError(THREAD *thread, INTERPRETER_STATE *state, AST_NODE *ast,
+                        char const *expected)
+{
+  VALUE value;
+  if (Evaluate(state, ast, &value))
+  {
+    ReleaseValue(&value);
+    snprintf(thread->failure, sizeof(thread->failure), "expected error '%s'", expected);
+    return false;
+  }
+
+  bool ok = strcmp(state->error, expected) == 0;
+  if (!ok)
+    snprintf(thread->failure, sizeof(thread->failure), "expected error '%s', got '%s'", expected,
+             state->error);
+  return ok;
+}
+
+static void *RunThread(void *data)
+{
+  THREAD *thread = data;
+  size_t index = thread->index;
+
+  INTERPRETER_STATE state = NewInterpreterState(8);
+  AST_NODE *define =
+      ParseFormatted("x = %zu, f = fn(n) { if (n) { f(n - 1) + x } else { 0 } }, f(100)", index);
+  AST_NODE *fail = ParseFormatted("f(3), missing%zu", index);
+  AST_NODE *call = ParseProgram("f(10)");
+
+  char expected_error[64];
+  snprintf(expected_error, sizeof(expected_error), "Unknown variable 'missing%zu'.", index);
+
+  thread->ok = ExpectNumber(thread, &state, define, 100.0 * index);
+  for (size_t round = 0; thread->ok && round < ROUNDS; round++)
+    thread->ok = ExpectError(thread, &state, fail, expected_error) &&
+                 ExpectNumber(thread, &state, call, 10.0 * index);
+
+  FreeAST(call);
+  FreeAST(fail);
+  FreeAST(define);
+  FreeInterpreterState(&state);
+  return NULL;
+}
+
+int main(void)
+{
+  THREAD threads[THREAD_COUNT];
+  pthread_t ids[THREAD_COUNT];
+  for (size_t i = 0; i < THREAD_COUNT; i++)
+  {
+    threads[i] = (THREAD){.index = i + 1};
+    if (pthread_create(&ids[i], NULL, RunThread, &threads[i]) != 0)
+    {
+      fprintf(stderr, "Could not start thread %zu.\n", i);
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < THREAD_COUNT; i++)
+  {
+    pthread_join(ids[i], NULL);
+    if (!threads[i].ok)
+    {
+      fprintf(stderr, "Thread %zu: %s\n", i, threads[i].failure);
+      ok = false;
+    }
+  }
+
+  return ok ? 0 : 1;
+}